@@ -66,6 +66,16 @@ mesh [constants] :filename [coord_system]
 			- load a mesh or set of edges (in some format that
 			  you can specify) from a file into the pointlist 
 			  and or edge list directly.
+			- OBJ faces with texture coordinates (vt) are
+			  textured when their material (usemtl, from the
+			  mtllib) has a map_Kd image.
+
+texture filename x0 y0 z0 x1 y1 z1 x2 y2 z2 x3 y3 z3
+			- draws the image in filename (.ppm, or anything
+			  convert can read) on the quad with corners
+			  x0 y0 z0 (bottom left of the image), x1 y1 z1
+			  (bottom right), x2 y2 z2 (top right) and
+			  x3 y3 z3 (top left), counterclockwise.
 
 Knobs/Animation
 ---------------
@@ -0,0 +1,110 @@
+/*
+Bump allocator for data that only lives for one frame: the polygon and
+texture coordinate matrices geometry is generated into, and the coordinate
+system stack. Allocating is moving a pointer along a block, and
+arena_reset hands everything back at once by going back to the first
+block, without touching what was allocated.
+
+Blocks are kept from one frame to the next and filled again in the same
+order, so once the first frame has run, frames like it allocate nothing
+from malloc. A request that does not fit in the next block gets a new
+block of its own size inserted there.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+struct arena frame_arena;
+
+static struct arena_block*
+new_block(long size, struct arena_block* next)
+{
+  /*
+  Allocate a block with room for size bytes, followed by next.
+
+  @param: long size
+  @param: struct arena_block* next
+
+  @return: struct arena_block*
+  */
+  struct arena_block* b;
+
+  if (size < ARENA_BLOCK)
+    size = ARENA_BLOCK;
+  b = (struct arena_block*)malloc(sizeof(struct arena_block) + size);
+  if (b == NULL) {
+    printf("Error: out of memory allocating a %ld byte frame block\n", size);
+    exit(-1);
+  }
+  b->next = next;
+  b->size = size;
+  return b;
+}
+
+void*
+arena_alloc(struct arena* a, long size)
+{
+  /*
+  Return size bytes from a, aligned to ARENA_ALIGN. They stay valid until
+  the next arena_reset.
+
+  @param: struct arena* a
+  @param: long size
+
+  @return: void*
+  */
+  void* p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(long)(ARENA_ALIGN - 1);
+
+  if (a->first == NULL)
+    a->first = a->block = new_block(size, NULL);
+
+  if (a->used + size > a->block->size) {
+    if (a->block->next == NULL || a->block->next->size < size)
+      a->block->next = new_block(size, a->block->next);
+    a->block = a->block->next;
+    a->used = 0;
+  }
+
+  p = a->block->data + a->used;
+  a->used += size;
+  return p;
+}
+
+void
+arena_reset(struct arena* a)
+{
+  /*
+  Free everything allocated from a, keeping its blocks for reuse.
+
+  @param: struct arena* a
+
+  @return: void
+  */
+  a->block = a->first;
+  a->used = 0;
+}
+
+void
+arena_free(struct arena* a)
+{
+  /*
+  Give the blocks of a back to the system.
+
+  @param: struct arena* a
+
+  @return: void
+  */
+  struct arena_block* b;
+
+  while (a->first) {
+    b = a->first;
+    a->first = b->next;
+    free(b);
+  }
+  a->block = NULL;
+  a->used = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#define ARENA_BLOCK (1 << 20)
+#define ARENA_ALIGN 16
+
+struct arena_block
+{
+  struct arena_block* next;
+  long size;
+  char data[];
+};
+
+struct arena
+{
+  struct arena_block* first;
+  /* the block being allocated from, and how much of it is taken */
+  struct arena_block* block;
+  long used;
+};
+
+extern struct arena frame_arena;
+
+void*
+arena_alloc(struct arena*, long);
+
+void
+arena_reset(struct arena*);
+
+void
+arena_free(struct arena*);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+Rendering several scripts in one process: ./mdl a.mdl b.mdl c.mdl. Each
+script is parsed and run on its own, with the parser reset in between, but
+meshes, tessellations and textures are loaded once for all of them (see
+meshcache.c), so an asset the scripts share is read once.
+
+The interpreter keeps one script's state in globals (op, symtab, the
+program, the frame buffers), so scripts cannot render side by side on
+threads of one process. With --jobs N the scripts run in N worker
+processes instead. The meshes and textures every script uses are loaded
+first, then the workers are forked and see them copy-on-write, and each
+worker takes the next script off a pipe until there are none left.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "matrix.h"
+#include "meshcache.h"
+#include "options.h"
+#include "parser.h"
+#include "perfctr.h"
+#include "texture.h"
+#include "y.tab.h"
+
+extern FILE* yyin;
+
+void
+yyrestart(FILE*);
+
+int
+yyparse();
+
+int
+parse_script(FILE* f)
+{
+  /*
+  Parse a script from f into op and the symbol table, which must have
+  been reset since the last script. Returns 1 if it parsed.
+
+  @param: FILE* f
+
+  @return: int
+  */
+  int parsed;
+
+  yyin = f;
+  yyrestart(yyin);
+  perf_stage(STAGE_PARSE);
+  parsed = yyparse() == 0;
+  perf_stage(STAGE_OTHER);
+  return parsed;
+}
+
+int
+run_script(char* file)
+{
+  /*
+  Parse and render the script in file. A script that does not parse is
+  still run, as far as it got, except under --watch where it is skipped
+  until it is saved again. Returns 0 if the file could not be opened or
+  the script could not be run.
+
+  @param: char* file
+
+  @return: int
+  */
+  FILE* f = fopen(file, "r");
+  int parsed;
+
+  if (f == NULL) {
+    printf("Error: could not open %s\n", file);
+    return 0;
+  }
+
+  opts.script = file;
+  parsed = parse_script(f);
+  fclose(f);
+  if (parsed || !opts.watch)
+    return script();
+  return 1;
+}
+
+static void
+preload()
+{
+  /*
+  Load the meshes and textures of every script before the workers are
+  forked.
+
+  @param: No parameters
+
+  @return: void
+  */
+  struct matrix* polygons = new_matrix(4, 100);
+  struct matrix* uvs = new_matrix(UV_ROWS, 100);
+  FILE* f;
+  int i, j;
+
+  for (i = 0; i < opts.script_count; i++) {
+    f = fopen(opts.scripts[i], "r");
+    if (f == NULL)
+      continue;
+    reset_parser();
+    parse_script(f);
+    fclose(f);
+    for (j = 0; j < lastop; j++) {
+      if (op[j].opcode == MESH)
+        mesh_polygons(polygons, uvs, op[j].op.mesh.name);
+      else if (op[j].opcode == TEXTURE)
+        load_texture(op[j].op.texture.p->name);
+      polygons->lastcol = 0;
+      uvs->lastcol = 0;
+    }
+  }
+  reset_parser();
+  free_matrix(polygons);
+  free_matrix(uvs);
+}
+
+static int
+worker(int queue)
+{
+  /*
+  Body of a worker process: run the scripts whose numbers come through the
+  queue pipe until it is empty. Returns the number that failed.
+
+  @param: int queue
+
+  @return: int
+  */
+  int i, failed = 0;
+
+  while (read(queue, &i, sizeof(i)) == sizeof(i)) {
+    reset_parser();
+    failed += !run_script(opts.scripts[i]);
+    fflush(stdout);
+  }
+  return failed;
+}
+
+int
+batch()
+{
+  /*
+  Render every script given on the command line, in this process or in
+  --jobs worker processes. Returns the number of scripts or workers that
+  failed.
+
+  @param: No parameters
+
+  @return: int
+  */
+  int i, status, failed = 0;
+  int workers = opts.jobs < opts.script_count ? opts.jobs : opts.script_count;
+  int queue[2];
+  pid_t pid;
+
+  if (workers < 2) {
+    for (i = 0; i < opts.script_count; i++) {
+      reset_parser();
+      failed += !run_script(opts.scripts[i]);
+    }
+    return failed;
+  }
+
+  preload();
+  printf("Batch: %d scripts in %d workers, %d meshes loaded\n",
+         opts.script_count,
+         workers,
+         meshes.count);
+  fflush(stdout);
+
+  if (pipe(queue) != 0) {
+    perror("Error: pipe");
+    return opts.script_count;
+  }
+  for (i = 0; i < workers; i++) {
+    pid = fork();
+    if (pid < 0) {
+      perror("Error: fork");
+      break;
+    }
+    if (pid == 0) {
+      close(queue[1]);
+      exit(worker(queue[0]) ? 1 : 0);
+    }
+  }
+  close(queue[0]);
+  if (i == 0) {
+    close(queue[1]);
+    return opts.script_count;
+  }
+
+  /* the workers read script numbers as they finish the one before; if
+     they have all died, the write fails instead of killing the parent */
+  signal(SIGPIPE, SIG_IGN);
+  for (i = 0; i < opts.script_count; i++)
+    if (write(queue[1], &i, sizeof(i)) != sizeof(i))
+      break;
+  close(queue[1]);
+
+  while (wait(&status) > 0)
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+  if (failed)
+    printf("Error: %d of %d workers failed\n", failed, workers);
+  return failed;
+}
@@ -0,0 +1,15 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+int
+parse_script(FILE*);
+
+int
+run_script(char*);
+
+int
+batch();
+
+#endif
@@ -0,0 +1,407 @@
+/*
+Microbenchmarks for the rendering kernels. Each kernel runs a few warmup
+batches and is then timed over a number of repetitions. The median, 95th
+percentile and fastest time per call are reported in microseconds. Run from
+the top of the repository (make microbench) so the bundled .obj files can be
+found.
+
+Usage: bench/microbench [-w warmup] [-r repetitions] [name filter]
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "draw.h"
+#include "fixed.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "ml6.h"
+#include "parser.h"
+#include "profile.h"
+#include "symtab.h"
+#include "wireframe.h"
+
+#define MAX_REPETITIONS 1000
+#define BATCH 1000
+
+/* profile.o reports against a parsed script, there is none here */
+struct command* op = NULL;
+int lastop = 0;
+
+screen s;
+zbuffer zb;
+color c;
+double samples[MAX_REPETITIONS];
+int warmup = 3;
+int repetitions = 25;
+char* filter = NULL;
+
+struct matrix* triangles;
+struct matrix* points;
+struct matrix* transform;
+double light[MAX_LIGHTS][2][3];
+double view[3] = { 0, 0, 1 };
+struct constants reflect;
+char* meshes[] = { "teapot.obj", "shuttle.obj", "skyscraper.obj",
+                   "airboat.obj" };
+
+void
+measure(char* name, void (*kernel)(int), int arg, int calls)
+{
+  /*
+  Time kernel(arg) and print the median, p95 and minimum time per call.
+  One invocation of kernel is expected to make calls calls.
+
+  @param: char* name
+  @param: void (*kernel)(int)
+  @param: int arg
+  @param: int calls
+
+  @return: void
+  */
+  int i, j;
+  double started, tmp;
+
+  if (filter && !strstr(name, filter))
+    return;
+
+  for (i = 0; i < warmup; i++)
+    kernel(arg);
+
+  for (i = 0; i < repetitions; i++) {
+    started = profile_clock();
+    kernel(arg);
+    samples[i] = (profile_clock() - started) / calls;
+  }
+
+  for (i = 1; i < repetitions; i++) {
+    tmp = samples[i];
+    for (j = i - 1; j >= 0 && samples[j] > tmp; j--)
+      samples[j + 1] = samples[j];
+    samples[j + 1] = tmp;
+  }
+
+  printf("%-28s %12.3f %12.3f %12.3f\n",
+         name,
+         samples[repetitions / 2] * 1e6,
+         samples[(int)ceil(repetitions * 0.95) - 1] * 1e6,
+         samples[0] * 1e6);
+}
+
+void
+line_kernel(int length)
+{
+  /*
+  Draw BATCH lines of the given length spread over the screen. Longer lines
+  run off the edge.
+
+  @param: int length
+
+  @return: void
+  */
+  int i, x, y;
+
+  for (i = 0; i < BATCH; i++) {
+    x = (i * 37) % XRES;
+    y = (i * 91) % YRES;
+    draw_line(x, y, 0, x + length, y + length / 2, 0, s, zb, c);
+  }
+}
+
+void
+wire_kernel(int length)
+{
+  /*
+  The same lines as line_kernel, drawn clipped by wire_line.
+
+  @param: int length
+
+  @return: void
+  */
+  int i, x, y;
+
+  for (i = 0; i < BATCH; i++) {
+    x = (i * 37) % XRES;
+    y = (i * 91) % YRES;
+    wire_line(x, y, 0, x + length, y + length / 2, 0, s, zb, c);
+  }
+}
+
+void
+scanline_kernel(int size)
+{
+  /*
+  Fill BATCH triangles from the triangles matrix.
+
+  @param: int size
+
+  @return: void
+  */
+  int i;
+
+  for (i = 0; i < triangles->lastcol; i += 3)
+    scanline_convert(triangles, i, s, zb, c);
+}
+
+void
+fixed_kernel(int size)
+{
+  /*
+  Fill the same triangles as scanline_kernel with the fixed point
+  rasterizer.
+
+  @param: int size
+
+  @return: void
+  */
+  int i;
+
+  for (i = 0; i < triangles->lastcol; i += 3)
+    fixed_triangle(triangles, i, s, zb, c);
+}
+
+void
+span_kernel(int width)
+{
+  /*
+  Draw BATCH horizontal spans of the given width.
+
+  @param: int width
+
+  @return: void
+  */
+  int i, x;
+
+  for (i = 0; i < BATCH; i++) {
+    x = (i * 37) % (XRES - width);
+    draw_scanline(x, 0, x + width, 10, i % YRES, s, zb, c);
+  }
+}
+
+void
+plot_kernel(int count)
+{
+  /*
+  Plot count pseudo random pixels.
+
+  @param: int count
+
+  @return: void
+  */
+  int i;
+  unsigned int r = 12345;
+
+  for (i = 0; i < count; i++) {
+    r = r * 1103515245 + 12345;
+    plot(s, zb, c, (r >> 8) % XRES, (r >> 20) % YRES, i & 255);
+  }
+}
+
+int
+matrix_loops(int cols)
+{
+  /*
+  Number of multiplications per batch, so every column count does about the
+  same amount of work.
+
+  @param: int cols
+
+  @return: int
+  */
+  return cols >= 64 * BATCH ? 1 : 64 * BATCH / cols;
+}
+
+void
+matrix_kernel(int cols)
+{
+  /*
+  Multiply a 4x4 transform against cols points, matrix_loops(cols) times.
+
+  @param: int cols
+
+  @return: void
+  */
+  int i;
+
+  points->lastcol = cols;
+  for (i = 0; i < matrix_loops(cols); i++)
+    matrix_mult(transform, points);
+}
+
+void
+lighting_kernel(int lights)
+{
+  /*
+  Light BATCH surface normals with the given number of lights.
+
+  @param: int lights
+
+  @return: void
+  */
+  int i;
+  double normal[3];
+
+  for (i = 0; i < BATCH; i++) {
+    normal[0] = i % 7 - 3;
+    normal[1] = i % 5 - 2;
+    normal[2] = 1;
+    c = get_lighting(normal, view, c, lights, light, &reflect);
+  }
+}
+
+void
+sphere_kernel(int step)
+{
+  /*
+  Generate the points of a sphere.
+
+  @param: int step
+
+  @return: void
+  */
+  free_matrix(generate_sphere(250, 250, 0, 100, step));
+}
+
+void
+torus_kernel(int step)
+{
+  /*
+  Generate the points of a torus.
+
+  @param: int step
+
+  @return: void
+  */
+  free_matrix(generate_torus(250, 250, 0, 25, 100, step));
+}
+
+void
+mesh_kernel(int i)
+{
+  /*
+  Parse one of the bundled .obj files.
+
+  @param: int i
+
+  @return: void
+  */
+  struct matrix* polygons = new_matrix(4, 1000);
+
+  obj_parser(polygons, NULL, meshes[i]);
+  free_matrix(polygons);
+}
+
+void
+make_triangles(int size)
+{
+  /*
+  Fill triangles with BATCH triangles about size pixels across.
+
+  @param: int size
+
+  @return: void
+  */
+  int i, x, y;
+
+  triangles->lastcol = 0;
+  for (i = 0; i < BATCH; i++) {
+    x = (i * 37) % (XRES - size);
+    y = (i * 91) % (YRES - size);
+    add_polygon(triangles, x, y, 0, x + size, y + size / 3, 0, x + size / 2,
+                y + size, 0);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  int i;
+  char name[64];
+  int sizes[] = { 4, 32, 128 };
+  int columns[] = { 4, 64, 1024, 16384 };
+
+  while ((i = getopt(argc, argv, "w:r:")) != -1) {
+    if (i == 'w')
+      warmup = atoi(optarg);
+    else if (i == 'r')
+      repetitions = atoi(optarg);
+    else {
+      printf("Usage: %s [-w warmup] [-r repetitions] [name filter]\n",
+             argv[0]);
+      return 1;
+    }
+  }
+  if (repetitions < 1 || repetitions > MAX_REPETITIONS)
+    repetitions = 25;
+  if (optind < argc)
+    filter = argv[optind];
+
+  clear_screen(s);
+  clear_zbuffer(zb);
+  c.red = c.green = c.blue = 200;
+
+  for (i = 0; i < 3; i++) {
+    reflect.r[i] = reflect.g[i] = reflect.b[i] = 0.5;
+  }
+  for (i = 0; i < MAX_LIGHTS; i++) {
+    light[i][LOCATION][0] = i - 4;
+    light[i][LOCATION][1] = 1;
+    light[i][LOCATION][2] = 1;
+    light[i][COLOR][RED] = 255;
+    light[i][COLOR][GREEN] = 128;
+    light[i][COLOR][BLUE] = 64;
+  }
+
+  triangles = new_matrix(4, 3 * BATCH);
+  transform = make_rotY(0.5);
+  points = new_matrix(4, 16384);
+  for (i = 0; i < 16384; i++) {
+    points->m[0][i] = i % 500;
+    points->m[1][i] = i / 500;
+    points->m[2][i] = 0;
+    points->m[3][i] = 1;
+  }
+
+  printf("%-28s %12s %12s %12s\n", "kernel (us per call)", "median", "p95",
+         "min");
+
+  for (i = 0; i < 3; i++) {
+    sprintf(name, "draw_line len=%d", sizes[i] * 8);
+    measure(name, line_kernel, sizes[i] * 8, BATCH);
+    sprintf(name, "wire_line len=%d", sizes[i] * 8);
+    measure(name, wire_kernel, sizes[i] * 8, BATCH);
+  }
+  for (i = 0; i < 3; i++) {
+    sprintf(name, "draw_scanline width=%d", sizes[i] * 2);
+    measure(name, span_kernel, sizes[i] * 2, BATCH);
+  }
+  for (i = 0; i < 3; i++) {
+    make_triangles(sizes[i]);
+    sprintf(name, "scanline_convert size=%d", sizes[i]);
+    measure(name, scanline_kernel, sizes[i], BATCH);
+    sprintf(name, "fixed_triangle size=%d", sizes[i]);
+    measure(name, fixed_kernel, sizes[i], BATCH);
+  }
+  measure("plot", plot_kernel, 100000, 100000);
+  for (i = 0; i < 4; i++) {
+    sprintf(name, "matrix_mult cols=%d", columns[i]);
+    measure(name, matrix_kernel, columns[i], matrix_loops(columns[i]));
+  }
+  for (i = 1; i <= MAX_LIGHTS; i++) {
+    sprintf(name, "get_lighting lights=%d", i);
+    measure(name, lighting_kernel, i, BATCH);
+  }
+  measure("generate_sphere step=100", sphere_kernel, 100, 1);
+  measure("generate_torus step=100", torus_kernel, 100, 1);
+  for (i = 0; i < sizeof(meshes) / sizeof(meshes[0]); i++) {
+    sprintf(name, "obj_parser %s", meshes[i]);
+    measure(name, mesh_kernel, i, 1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Render every bundled scene headlessly and compare the framebuffer checksums
+# against bench/golden.txt. Run from the top of the repository (make bench).
+# Pass --update to rewrite golden.txt with the checksums from this run.
+
+MDL=./mdl
+GOLDEN=bench/golden.txt
+SCENES="teapot.mdl airboat.mdl flyover.mdl
+scripts/cart.mdl scripts/cart2.mdl scripts/coords.mdl scripts/face.mdl
+scripts/ring.mdl scripts/robot.mdl scripts/rolling.mdl
+scripts/simple_anim.mdl scripts/textured.mdl scripts/tweened.mdl
+scripts/wheels.mdl"
+
+update=0
+if [ "$1" = "--update" ]; then
+  update=1
+  : > $GOLDEN.new
+fi
+
+failed=0
+printf "%-26s %7s %10s %14s %14s  %s\n" scene frames ms/frame tris/s px/s result
+
+for scene in $SCENES; do
+  line=$($MDL --bench $scene | grep '^bench:')
+  if [ -z "$line" ]; then
+    printf "%-26s %s\n" $scene "did not finish"
+    failed=1
+    continue
+  fi
+
+  frames=$(echo "$line" | sed 's/.*frames=\([^ ]*\).*/\1/')
+  msframe=$(echo "$line" | sed 's/.*ms\/frame=\([^ ]*\).*/\1/')
+  tris=$(echo "$line" | sed 's/.*tris\/s=\([^ ]*\).*/\1/')
+  pixels=$(echo "$line" | sed 's/.*px\/s=\([^ ]*\).*/\1/')
+  sum=$(echo "$line" | sed 's/.*checksum=\([^ ]*\).*/\1/')
+  expected=$(grep "^$scene " $GOLDEN 2>/dev/null | cut -d" " -f2)
+
+  if [ $update = 1 ]; then
+    echo "$scene $sum" >> $GOLDEN.new
+    result="recorded"
+  elif [ "$sum" = "$expected" ]; then
+    result="ok"
+  else
+    result="MISMATCH $sum != $expected"
+    failed=1
+  fi
+
+  printf "%-26s %7s %10s %14s %14s  %s\n" \
+    $scene $frames $msframe $tris $pixels "$result"
+done
+
+if [ $update = 1 ]; then
+  mv $GOLDEN.new $GOLDEN
+fi
+
+exit $failed
@@ -0,0 +1,281 @@
+/*
+Lowers the op[] array produced by the parser into a compact program that
+script() runs once per frame. Commands that only matter before rendering
+starts are dropped, and runs of move/scale/rotate commands that do not use a
+knob are multiplied together ahead of time into a single TRANSFORM.
+Coordinate systems saved where no knob is in effect are worked out here
+too, so the frames only copy them.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compile.h"
+#include "matrix.h"
+#include "parser.h"
+#include "symtab.h"
+#include "y.tab.h"
+
+struct instruction* program = NULL;
+int lastinst = 0;
+
+static void
+emit(int opcode, int index, struct matrix* m, int dynamic)
+{
+  /*
+  Append an instruction to the program.
+
+  @param: int opcode
+  @param: int index
+  @param: struct matrix* m
+  @param: int dynamic
+
+  @return: void
+  */
+  program[lastinst].opcode = opcode;
+  program[lastinst].index = index;
+  program[lastinst].m = m;
+  program[lastinst].dynamic = dynamic;
+  lastinst++;
+}
+
+static struct matrix*
+static_transform(int i)
+{
+  /*
+  Return the transformation matrix for op[i] if it is a move, scale or rotate
+  without a knob, otherwise NULL.
+
+  @param: int i
+
+  @return: struct matrix*
+  */
+  double theta;
+
+  switch (op[i].opcode) {
+    case MOVE:
+      if (op[i].op.move.p != NULL)
+        return NULL;
+      return make_translate(
+        op[i].op.move.d[0], op[i].op.move.d[1], op[i].op.move.d[2]);
+    case SCALE:
+      if (op[i].op.scale.p != NULL)
+        return NULL;
+      return make_scale(
+        op[i].op.scale.d[0], op[i].op.scale.d[1], op[i].op.scale.d[2]);
+    case ROTATE:
+      if (op[i].op.rotate.p != NULL)
+        return NULL;
+      theta = op[i].op.rotate.degrees * (M_PI / 180);
+      if (op[i].op.rotate.axis == 0)
+        return make_rotX(theta);
+      else if (op[i].op.rotate.axis == 1)
+        return make_rotY(theta);
+      return make_rotZ(theta);
+  }
+  return NULL;
+}
+
+static SYMTAB**
+op_system(int i)
+{
+  /*
+  Where op[i] keeps the coordinate system it is drawn in, or NULL if it
+  has none. For lines this is the one for the first end.
+
+  @param: int i
+
+  @return: SYMTAB**
+  */
+  switch (op[i].opcode) {
+    case SPHERE:
+      return &op[i].op.sphere.cs;
+    case TORUS:
+      return &op[i].op.torus.cs;
+    case BOX:
+      return &op[i].op.box.cs;
+    case LINE:
+      return &op[i].op.line.cs0;
+    case MESH:
+      return &op[i].op.mesh.cs;
+    case TEXTURE:
+      return &op[i].op.texture.cs;
+  }
+  return NULL;
+}
+
+static int
+check_system(SYMTAB** cs, char* saved, int dynamic)
+{
+  /*
+  Return whether something drawn in coordinate system *cs moves with a
+  knob, given dynamic for the top of the stack. saved holds, for each
+  symbol, 0 until it is saved, then 1 plus whether it was saved under a
+  knob. A system used before it is saved is dropped, with a warning, and
+  the top of the stack is used instead.
+
+  @param: SYMTAB** cs
+  @param: char* saved
+  @param: int dynamic
+
+  @return: int
+  */
+  if (cs == NULL || *cs == NULL)
+    return dynamic;
+
+  if (!saved[(*cs)->index]) {
+    printf("Warning: coordinate system %s is used before it is saved\n",
+           (*cs)->name);
+    *cs = NULL;
+    return dynamic;
+  }
+  return saved[(*cs)->index] - 1;
+}
+
+void
+compile()
+{
+  /*
+  Build program from op. Knob-free transformations are folded so that
+  top * M0 * M1 * ... * Mn becomes top * F, with F computed once here.
+  Every instruction is marked dynamic if a knob transformation is in effect
+  for it, in its own push/pop level or one around it, or if it is drawn
+  in a coordinate system that was saved under one.
+
+  The top of the stack is followed through the knob-free transformations
+  as well. A save_coord_system with no knob in effect gets it as a
+  matrix of its own, and its frames copy that instead of the stack.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+  int folded = -1;
+  int depth = 0;
+  int moves;
+  char* dynamic;
+  char* saved;
+  struct matrix** top;
+  struct matrix* step;
+  struct matrix* fold = NULL;
+  struct matrix* m;
+
+  free_program();
+  program = (struct instruction*)malloc((lastop + 1) *
+                                        sizeof(struct instruction));
+  dynamic = (char*)calloc(lastop + 2, 1);
+  saved = (char*)calloc(lastsym + 1, 1);
+  top = (struct matrix**)calloc(lastop + 2, sizeof(struct matrix*));
+  top[0] = new_matrix(4, 4);
+  ident(top[0]);
+  step = new_matrix(4, 4);
+  ident(step);
+
+  for (i = 0; i < lastop; i++) {
+    m = static_transform(i);
+    if (m != NULL) {
+      copy_matrix(m, step);
+      matrix_mult(top[depth], step);
+      copy_matrix(step, top[depth]);
+      if (fold == NULL) {
+        fold = m;
+        folded = i;
+      } else {
+        matrix_mult(fold, m);
+        free_matrix(fold);
+        fold = m;
+      }
+      continue;
+    }
+
+    if (op[i].opcode == PUSH) {
+      depth++;
+      dynamic[depth] = dynamic[depth - 1];
+      if (top[depth] == NULL) {
+        top[depth] = new_matrix(4, 4);
+        ident(top[depth]);
+      }
+      copy_matrix(top[depth - 1], top[depth]);
+    } else if (op[i].opcode == POP && depth > 0)
+      depth--;
+    else if (op[i].opcode == MOVE || op[i].opcode == SCALE ||
+             op[i].opcode == ROTATE)
+      dynamic[depth] = 1;
+
+    moves = check_system(op_system(i), saved, dynamic[depth]);
+    if (op[i].opcode == LINE)
+      moves |= check_system(&op[i].op.line.cs1, saved, dynamic[depth]);
+
+    switch (op[i].opcode) {
+      case CONSTANTS:
+      case CAMERA:
+      case AMBIENT:
+      case SET:
+      case BASENAME:
+      case SAVE_KNOBS:
+      case TWEEN:
+      case FRAMES:
+      case VARY:
+      case SETKNOBS:
+      case FOCAL:
+      case GENERATE_RAYFILES:
+      case WEB:
+        break;
+      case SAVE:
+      case DISPLAY:
+      case SHADING:
+        emit(op[i].opcode, i, NULL, dynamic[depth]);
+        break;
+      case SAVE_COORDS:
+        saved[op[i].op.save_coordinate_system.p->index] = 1 + dynamic[depth];
+        if (!dynamic[depth]) {
+          m = new_matrix(4, 4);
+          ident(m);
+          copy_matrix(top[depth], m);
+          emit(SAVE_COORDS, i, m, 0);
+          break;
+        }
+        /* saved from the stack each frame */
+        /* fall through */
+      default:
+        if (fold != NULL) {
+          emit(TRANSFORM, folded, fold, dynamic[depth]);
+          fold = NULL;
+        }
+        emit(op[i].opcode, i, NULL, moves);
+    }
+  }
+
+  if (fold != NULL)
+    free_matrix(fold);
+  for (i = 0; i < lastop + 2; i++)
+    if (top[i] != NULL)
+      free_matrix(top[i]);
+  free_matrix(step);
+  free(top);
+  free(dynamic);
+  free(saved);
+}
+
+void
+free_program()
+{
+  /*
+  Release the program along with any folded matrices.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  for (i = 0; i < lastinst; i++)
+    if (program[i].m != NULL)
+      free_matrix(program[i].m);
+
+  free(program);
+  program = NULL;
+  lastinst = 0;
+}
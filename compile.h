@@ -0,0 +1,27 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include "matrix.h"
+
+/* a folded run of knob-free move/scale/rotate commands */
+#define TRANSFORM 1
+
+struct instruction
+{
+  int opcode;
+  int index;
+  struct matrix* m;
+  /* drawn under a transformation that uses a knob */
+  int dynamic;
+};
+
+extern struct instruction* program;
+extern int lastinst;
+
+void
+compile();
+
+void
+free_program();
+
+#endif
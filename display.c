@@ -10,10 +10,12 @@ value standing for red, green and blue respectively.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "display.h"
 #include "ml6.h"
+#include "profile.h"
 
 void
 plot(screen s, zbuffer zb, color c, int x, int y, double z)
@@ -30,10 +32,17 @@ plot(screen s, zbuffer zb, color c, int x, int y, double z)
   @return: void
   */
   int newy = YRES - 1 - y;
+  depth_t d;
+
   z = (int)(z * 1000) / 1000.0;
-  if (x >= 0 && x < XRES && newy >= 0 && newy < YRES && zb[x][newy] <= z) {
-    s[x][newy] = c;
-    zb[x][newy] = z;
+  if (x >= 0 && x < XRES && newy >= 0 && newy < YRES) {
+    prof.depth_tests++;
+    d = DEPTH_ENCODE(z);
+    if (DEPTH_TEST(zb[x][newy], d)) {
+      s[x][newy] = c;
+      zb[x][newy] = d;
+      prof.pixels++;
+    }
   }
 }
 
@@ -63,7 +72,7 @@ void
 clear_zbuffer(zbuffer zb)
 {
   /*
-  Sets all entries in the zbufffer to LONG_MIN.
+  Sets all entries in the zbufffer to DEPTH_CLEAR, farther than anything.
 
   @param: zbuffer
 
@@ -73,37 +82,165 @@ clear_zbuffer(zbuffer zb)
 
   for (y = 0; y < YRES; y++)
     for (x = 0; x < XRES; x++)
-      zb[x][y] = LONG_MIN;
+      zb[x][y] = DEPTH_CLEAR;
+}
+
+unsigned long long
+checksum_screen(screen s, unsigned long long hash)
+{
+  /*
+  Fold the pixels of s into hash using 64 bit FNV-1a, in the same row order
+  the image is saved in. Start with hash = CHECKSUM_SEED.
+
+  @param: screen s
+  @param: unsigned long long hash
+
+  @return: unsigned long long
+  */
+  int x, y;
+
+  for (y = 0; y < YRES; y++) {
+    for (x = 0; x < XRES; x++) {
+      hash = (hash ^ (unsigned char)s[x][y].red) * 1099511628211ULL;
+      hash = (hash ^ (unsigned char)s[x][y].green) * 1099511628211ULL;
+      hash = (hash ^ (unsigned char)s[x][y].blue) * 1099511628211ULL;
+    }
+  }
+  return hash;
 }
 
 void
-save_ppm(screen s, char* file)
+pack_rgb24(screen s, unsigned char* rgb)
 {
   /*
-  Saves screen s as a valid ppm file using the settings in ml6.h.
+  Pack s into rgb as XRES * YRES * 3 bytes, row by row from the top, with
+  each channel clamped to 0..255. This is the layout of a P6 body and of a
+  raw rgb24 video frame.
 
   @param: screen s
-  @char: char* file
+  @param: unsigned char* rgb
 
-  @returns: void
+  @return: void
   */
   int x, y;
-  int fd;
-  char header[16];
-  unsigned char pixel[3];
+  int c[3], i;
 
-  fd = open(file, O_CREAT | O_WRONLY, 0644);
-  sprintf(header, "P6\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  write(fd, header, sizeof(header) - 1);
   for (y = 0; y < YRES; y++) {
     for (x = 0; x < XRES; x++) {
-      pixel[0] = s[x][y].red;
-      pixel[1] = s[x][y].green;
-      pixel[2] = s[x][y].blue;
-      write(fd, pixel, sizeof(pixel));
+      c[0] = s[x][y].red;
+      c[1] = s[x][y].green;
+      c[2] = s[x][y].blue;
+      for (i = 0; i < 3; i++)
+        *rgb++ = c[i] < 0 ? 0 : c[i] > 255 ? 255 : c[i];
+    }
+  }
+}
+
+void
+write_image(char* file, char* header, screen s)
+{
+  /*
+  Write header followed by the packed pixels of s to file, replacing
+  anything already there. The pixels are packed into one buffer and both
+  parts go out together with writev, into a temporary file that is renamed
+  over file, so frames hardlinked to the old file keep their own image.
+
+  @param: char* file
+  @param: char* header
+  @param: screen s
+
+  @return: void
+  */
+  int fd;
+  long n, size, skip;
+  unsigned char* rgb;
+  struct iovec parts[2];
+  char temp[PATH_MAX];
+
+  snprintf(temp, sizeof(temp), "%s.%d.tmp", file, (int)getpid());
+  fd = open(temp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Error: could not open %s: %s\n", temp, strerror(errno));
+    return;
+  }
+
+  rgb = (unsigned char*)malloc(XRES * YRES * 3);
+  pack_rgb24(s, rgb);
+
+  parts[0].iov_base = header;
+  parts[0].iov_len = strlen(header);
+  parts[1].iov_base = rgb;
+  parts[1].iov_len = XRES * YRES * 3;
+
+  size = parts[0].iov_len + parts[1].iov_len;
+  n = writev(fd, parts, 2);
+  while (n >= 0 && n < size) {
+    /* a short write, carry on from where it stopped */
+    prof.bytes += n;
+    size -= n;
+    skip = n;
+    if (skip < (long)parts[0].iov_len) {
+      parts[0].iov_base = (char*)parts[0].iov_base + skip;
+      parts[0].iov_len -= skip;
+    } else {
+      skip -= parts[0].iov_len;
+      parts[0].iov_len = 0;
+      parts[1].iov_base = (char*)parts[1].iov_base + skip;
+      parts[1].iov_len -= skip;
     }
+    n = writev(fd, parts, 2);
   }
+  if (n < 0)
+    printf("Error: could not write %s: %s\n", file, strerror(errno));
+  else
+    prof.bytes += n;
+
+  free(rgb);
   close(fd);
+  if (n < 0)
+    unlink(temp);
+  else if (rename(temp, file) != 0) {
+    printf("Error: could not rename %s: %s\n", temp, strerror(errno));
+    unlink(temp);
+  }
+}
+
+void
+save_ppm(screen s, char* file)
+{
+  /*
+  Saves screen s as a binary (P6) ppm file using the settings in ml6.h.
+
+  @param: screen s
+  @char: char* file
+
+  @returns: void
+  */
+  char header[64];
+
+  sprintf(header, "P6\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
+  write_image(file, header, s);
+}
+
+void
+save_pam(screen s, char* file)
+{
+  /*
+  Saves screen s as a pam (P7) file with an RGB tuple type.
+
+  @param: screen s
+  @char: char* file
+
+  @returns: void
+  */
+  char header[128];
+
+  sprintf(header,
+          "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL %d\nTUPLTYPE RGB\nENDHDR\n",
+          XRES,
+          YRES,
+          MAX_COLOR);
+  write_image(file, header, s);
 }
 
 void
@@ -111,8 +248,9 @@ save_extension(screen s, char* file)
 {
   /*
   Saves the screen stored in s to the filename represented by file.
-  If the extension for file is an image format supported by the "convert"
-  command, the image will be saved in that format.
+  .ppm and .pam files are written directly. For any other extension
+  supported by the "convert" command, the image will be saved in that
+  format.
 
   @param: screen s
   @char: char* file
@@ -122,15 +260,29 @@ save_extension(screen s, char* file)
   int x, y;
   FILE* f;
   char line[256];
+  char* extension = strrchr(file, '.');
+
+  if (extension && strcmp(extension, ".ppm") == 0) {
+    save_ppm(s, file);
+    return;
+  }
+  if (extension && strcmp(extension, ".pam") == 0) {
+    save_pam(s, file);
+    return;
+  }
 
+  /* convert truncates the file it writes, which would change every frame
+     hardlinked to it */
+  unlink(file);
   sprintf(line, "convert - %s", file);
 
   f = popen(line, "w");
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
+  prof.bytes += fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
   for (y = 0; y < YRES; y++) {
     for (x = 0; x < XRES; x++)
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
+      prof.bytes +=
+        fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
+    prof.bytes += fprintf(f, "\n");
   }
   pclose(f);
 }
@@ -176,9 +328,14 @@ make_animation(char* name)
   sprintf(name_arg, "anim/%s*", name);
   strncat(name, ".gif", 128);
   printf("Making animation: %s\n", name);
+  /* so the child does not write what is still buffered a second time */
+  fflush(stdout);
   f = fork();
   if (f == 0) {
     e = execlp("convert", "convert", "-delay", "1.7", name_arg, name, NULL);
     printf("e: %d errno: %d: %s\n", e, errno, strerror(errno));
+    /* not exit, which would run the parent's atexit handlers */
+    fflush(stdout);
+    _exit(127);
   }
 }
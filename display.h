@@ -10,9 +10,18 @@ void clear_screen(screen);
 
 void clear_zbuffer(zbuffer);
 
+unsigned long long
+checksum_screen(screen, unsigned long long);
+
+void
+pack_rgb24(screen, unsigned char*);
+
 void
 save_ppm(screen, char*);
 
+void
+save_pam(screen, char*);
+
 void
 save_extension(screen, char*);
 
@@ -1,13 +1,51 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "display.h"
 #include "draw.h"
+#include "fixed.h"
 #include "gmath.h"
 #include "math.h"
 #include "matrix.h"
 #include "ml6.h"
+#include "msaa.h"
+#include "options.h"
+#include "perfctr.h"
+#include "profile.h"
+#include "shadow.h"
 #include "symtab.h"
+#include "texture.h"
+
+/* a triangle's normal and lit color, between the two passes of
+   draw_polygons */
+struct lit_triangle
+{
+  double normal[3];
+  color c;
+};
+
+static struct lit_triangle* lit_buffer = NULL;
+static int lit_size = 0;
+
+int
+shading_mode(char* name)
+{
+  /*
+  Return the shading mode for the name given to the shading command.
+  Lighting is worked out once per triangle, so gouraud and phong are drawn
+  like flat.
+
+  @param: char* name
+
+  @return: int
+  */
+  if (strcmp(name, "wireframe") == 0)
+    return SHADING_WIREFRAME;
+  if (strcmp(name, "raytrace") == 0)
+    return SHADING_RAYTRACE;
+  return SHADING_FLAT;
+}
 
 void
 draw_scanline(int x0,
@@ -184,15 +222,22 @@ draw_polygons(struct matrix* polygons,
               int lights,
               double light[MAX_LIGHTS][2][3],
               color ambient,
-              struct constants* reflect)
+              struct constants* reflect,
+              struct matrix* uvs)
 {
   /*
   Goes through polygons 3 points at a time, drawing lines connecting each points
-  to create bounding triangles.
+  to create bounding triangles. Triangles with a texture in uvs (which may be
+  NULL) are textured, or drawn in the texture's average color where samples
+  are shaded later (--msaa, --shadows).
+
+  Every triangle is lit first and then they are all rasterized, so --perf
+  changes stage twice per call rather than twice per triangle.
 
   @param: struct matrix *polygons
   @param: screen s
   @param: color c
+  @param: struct matrix *uvs
 
   @return: void
   */
@@ -201,17 +246,55 @@ draw_polygons(struct matrix* polygons,
     return;
   }
 
-  int point;
+  int point, texture, n;
   double* normal;
+  struct lit_triangle* lit;
+  int stage = perf.stage;
+
+  n = polygons->lastcol / 3;
+  if (n > lit_size) {
+    lit_size = 2 * n;
+    lit_buffer = (struct lit_triangle*)realloc(
+      lit_buffer, lit_size * sizeof(struct lit_triangle));
+  }
 
-  for (point = 0; point < polygons->lastcol - 2; point += 3) {
-    normal = calculate_normal(polygons, point);
+  perf_stage(STAGE_LIGHTING);
+  for (point = 0, lit = lit_buffer; point < polygons->lastcol - 2;
+       point += 3, lit++) {
+    calculate_normal(polygons, point, lit->normal);
+    prof.triangles++;
+
+    if (lit->normal[2] > 0) {
+      lit->c = get_lighting(lit->normal, view, ambient, lights, light, reflect);
+      texture = uvs ? (int)uvs->m[2][point] : NO_TEXTURE;
+      if (texture != NO_TEXTURE && (shadows.enabled || msaa.samples))
+        lit->c = texture_flat(texture, lit->c);
+    } else
+      prof.culled++;
+  }
 
+  perf_stage(STAGE_RASTER);
+  for (point = 0, lit = lit_buffer; point < polygons->lastcol - 2;
+       point += 3, lit++) {
+    normal = lit->normal;
     if (normal[2] > 0) {
-      color i = get_lighting(normal, view, ambient, lights, light, reflect);
-      scanline_convert(polygons, point, s, zb, i);
+      texture = uvs ? (int)uvs->m[2][point] : NO_TEXTURE;
+      if (shadows.enabled)
+        shadow_triangle(polygons, point, normal, 1, lights, reflect, lit->c);
+      else if (msaa.samples)
+        msaa_triangle(polygons, point, lit->c);
+      else if (texture != NO_TEXTURE)
+        texture_triangle(polygons, uvs, point, s, zb, lit->c);
+      else if (opts.raster == RASTER_FIXED)
+        fixed_triangle(polygons, point, s, zb, lit->c);
+      else
+        scanline_convert(polygons, point, s, zb, lit->c);
+    } else if (shadows.enabled) {
+      /* still casts a shadow */
+      shadow_triangle(polygons, point, normal, 0, lights, reflect, ambient);
     }
   }
+  perf_stage(stage);
 }
 
 void
@@ -617,7 +700,7 @@ add_point(struct matrix* points, double x, double y, double z)
   @return: void
   */
   if (points->lastcol == points->cols)
-    grow_matrix(points, points->lastcol + 100);
+    grow_matrix(points, 2 * points->lastcol + 100);
 
   points->m[0][points->lastcol] = x;
   points->m[1][points->lastcol] = y;
@@ -5,6 +5,14 @@
 #include "ml6.h"
 #include "symtab.h"
 
+/* shading modes, set by the shading command */
+#define SHADING_FLAT 0
+#define SHADING_WIREFRAME 1
+#define SHADING_RAYTRACE 2
+
+int
+shading_mode(char*);
+
 void
 draw_scanline(int, double, int, double, int, screen, zbuffer, color);
 
@@ -31,7 +39,8 @@ draw_polygons(struct matrix*,
               int,
               double[MAX_LIGHTS][2][3],
               color,
-              struct constants*);
+              struct constants*,
+              struct matrix*);
 
 void
 add_box(struct matrix*, double, double, double, double, double, double);
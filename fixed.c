@@ -0,0 +1,228 @@
+/*
+Fixed point triangle rasterizer, used with --raster fixed. Vertices are
+snapped to 24.8 fixed point and the three edge functions are evaluated at
+pixel centers in 64 bit integers. Each row's span is solved for exactly from
+the edge values at its start, and the edges are stepped across it without
+error. A top-left fill rule gives every pixel on a shared edge to exactly
+one triangle. Depth comes straight from the plane of the triangle at each
+pixel center, using the integer edge values as barycentric weights, so
+nothing accumulates and nothing is rounded to 1/1000. fixed_shaded fills the
+same pixels with colors from a shader given those weights, which is how
+textured triangles are drawn under --raster fixed.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "draw.h"
+#include "fixed.h"
+#include "matrix.h"
+#include "ml6.h"
+#include "profile.h"
+
+long long
+floor_div(long long n, long long d)
+{
+  /*
+  n / d rounded down, for d > 0.
+
+  @param: long long n
+  @param: long long d
+
+  @return: long long
+  */
+  return n >= 0 ? n / d : -((-n + d - 1) / d);
+}
+
+static int
+fill(struct matrix* points,
+     int i,
+     screen s,
+     zbuffer zb,
+     color c,
+     fixed_shader shade,
+     void* data)
+{
+  /*
+  Fill triangle i of points with color c, or with the colors shade gives
+  for each pixel if it is not NULL. Returns 0, drawing nothing, if the
+  triangle is too far out for 64 bit edge functions.
+
+  @param: struct matrix* points
+  @param: int i
+  @param: screen s
+  @param: zbuffer zb
+  @param: color c
+  @param: fixed_shader shade
+  @param: void* data
+
+  @return: int
+  */
+  long long x[3], y[3];
+  long long a[3], b[3], e[3], row[3], w[3];
+  long long area, px, py, swap, first, last, k;
+  double z[3], inverse, start, step, weights[3];
+  depth_t depth;
+  int xmin, xmax, ymin, ymax, col, line;
+  int j, u, v;
+  /* the vertex of points each of x, y and z came from */
+  int vertex[3] = { 0, 1, 2 };
+
+  for (j = 0; j < 3; j++) {
+    if (points->m[0][i + j] < -FIXED_LIMIT ||
+        points->m[0][i + j] > FIXED_LIMIT ||
+        points->m[1][i + j] < -FIXED_LIMIT ||
+        points->m[1][i + j] > FIXED_LIMIT)
+      return 0;
+    x[j] = llround(points->m[0][i + j] * SUBPIXEL);
+    y[j] = llround(points->m[1][i + j] * SUBPIXEL);
+    z[j] = points->m[2][i + j];
+  }
+
+  area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0)
+    return 1;
+  if (area < 0) {
+    /* make the winding counterclockwise */
+    swap = x[1], x[1] = x[2], x[2] = swap;
+    swap = y[1], y[1] = y[2], y[2] = swap;
+    start = z[1], z[1] = z[2], z[2] = start;
+    vertex[1] = 2;
+    vertex[2] = 1;
+    area = -area;
+  }
+  inverse = 1.0 / area;
+
+  /*
+  Edge j runs from vertex u to vertex v, opposite vertex j, and is
+  a * px + b * py + e, positive inside. Pixels exactly on an edge only
+  count for top and left edges.
+  */
+  for (j = 0; j < 3; j++) {
+    u = (j + 1) % 3;
+    v = (j + 2) % 3;
+    a[j] = y[u] - y[v];
+    b[j] = x[v] - x[u];
+    e[j] = x[u] * y[v] - y[u] * x[v];
+    if (!(a[j] > 0 || (a[j] == 0 && b[j] < 0)))
+      e[j]--;
+  }
+
+  xmin = (int)((x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2])
+                            : (x[1] < x[2] ? x[1] : x[2])) >>
+               SUBPIXEL_BITS);
+  xmax = (int)((x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2])
+                            : (x[1] > x[2] ? x[1] : x[2])) >>
+               SUBPIXEL_BITS);
+  ymin = (int)((y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2])
+                            : (y[1] < y[2] ? y[1] : y[2])) >>
+               SUBPIXEL_BITS);
+  ymax = (int)((y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2])
+                            : (y[1] > y[2] ? y[1] : y[2])) >>
+               SUBPIXEL_BITS);
+  xmin = xmin < 0 ? 0 : xmin;
+  ymin = ymin < 0 ? 0 : ymin;
+  xmax = xmax >= XRES ? XRES - 1 : xmax;
+  ymax = ymax >= YRES ? YRES - 1 : ymax;
+  if (xmin > xmax || ymin > ymax)
+    return 1;
+
+  /* edge values at the center of pixel (xmin, ymin) */
+  px = ((long long)xmin << SUBPIXEL_BITS) + SUBPIXEL / 2;
+  py = ((long long)ymin << SUBPIXEL_BITS) + SUBPIXEL / 2;
+  for (j = 0; j < 3; j++)
+    row[j] = a[j] * px + b[j] * py + e[j];
+
+  for (line = ymin; line <= ymax; line++) {
+    /*
+    Each edge is a linear function of the column, so the columns where it
+    is not negative can be solved for exactly: the span is where all three
+    agree.
+    */
+    first = 0;
+    last = xmax - xmin;
+    for (j = 0; j < 3; j++) {
+      if (a[j] > 0) {
+        k = -floor_div(row[j], a[j] * SUBPIXEL);
+        first = k > first ? k : first;
+      } else if (a[j] < 0) {
+        k = floor_div(row[j], -a[j] * SUBPIXEL);
+        last = k < last ? k : last;
+      } else if (row[j] < 0)
+        last = -1;
+    }
+
+    /* depth along the span, from the exact edge values where it starts */
+    for (j = 0; j < 3; j++)
+      w[j] = row[j] + a[j] * SUBPIXEL * first;
+    start = (w[0] * z[0] + w[1] * z[1] + w[2] * z[2]) * inverse;
+    step = (a[0] * z[0] + a[1] * z[1] + a[2] * z[2]) * SUBPIXEL * inverse;
+
+    for (k = 0; k <= last - first; k++) {
+      col = xmin + first + k;
+      depth = DEPTH_ENCODE(start + k * step);
+      prof.depth_tests++;
+      if (DEPTH_TEST(zb[col][YRES - 1 - line], depth)) {
+        if (shade) {
+          for (j = 0; j < 3; j++)
+            weights[vertex[j]] = (w[j] + a[j] * SUBPIXEL * k) * inverse;
+          c = shade(weights, data);
+        }
+        s[col][YRES - 1 - line] = c;
+        zb[col][YRES - 1 - line] = depth;
+        prof.pixels++;
+      }
+    }
+
+    for (j = 0; j < 3; j++)
+      row[j] += b[j] * SUBPIXEL;
+  }
+  return 1;
+}
+
+void
+fixed_triangle(struct matrix* points, int i, screen s, zbuffer zb, color c)
+{
+  /*
+  Fill triangle i of points with color c.
+
+  @param: struct matrix* points
+  @param: int i
+  @param: screen s
+  @param: zbuffer zb
+  @param: color c
+
+  @return: void
+  */
+  if (!fill(points, i, s, zb, c, NULL, NULL))
+    scanline_convert(points, i, s, zb, c);
+}
+
+int
+fixed_shaded(struct matrix* points,
+             int i,
+             screen s,
+             zbuffer zb,
+             fixed_shader shade,
+             void* data)
+{
+  /*
+  Fill triangle i of points with the color shade gives for each pixel
+  that passes the depth test, from the weights of the triangle's three
+  vertices there. Returns 0, drawing nothing, if the triangle is too far
+  out for the fixed point rasterizer.
+
+  @param: struct matrix* points
+  @param: int i
+  @param: screen s
+  @param: zbuffer zb
+  @param: fixed_shader shade
+  @param: void* data
+
+  @return: int
+  */
+  color none = { 0, 0, 0 };
+
+  return fill(points, i, s, zb, none, shade, data);
+}
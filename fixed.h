@@ -0,0 +1,24 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+#define RASTER_SCANLINE 0
+#define RASTER_FIXED 1
+
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL (1 << SUBPIXEL_BITS)
+#define FIXED_LIMIT (1 << 20)
+
+/* the color of a pixel, given the weights of a triangle's three vertices
+   there */
+typedef color (*fixed_shader)(double*, void*);
+
+void
+fixed_triangle(struct matrix*, int, screen, zbuffer, color);
+
+int
+fixed_shaded(struct matrix*, int, screen, zbuffer, fixed_shader, void*);
+
+#endif
@@ -0,0 +1,569 @@
+/*
+Skips frames that would come out the same as an image already on disk.
+Every frame gets a key: a 64 bit FNV-1a hash of the compiled program (with
+the contents of the constants, lights and mesh files it uses) and of the
+knob values for that frame. Keys of finished frames are appended to
+anim/.<basename>.manifest as they are saved, and at the end of the run the
+manifest is rewritten with one key per frame, so it does not grow. A frame
+whose key matches the manifest and whose image still exists is not
+rendered again, and a frame with the same key as another frame is
+hardlinked to that frame's image instead of being rendered. Images are
+replaced by renaming a new file over them (see write_image), never
+rewritten in place, so re-rendering a frame leaves the frames linked to it
+alone.
+
+Under --watch, frames that are not saved to anim/ (--preview, --stream,
+--headless, or a script of one frame) are kept in memory instead, with
+their keys, up to MEMORY_BUDGET bytes. The next run shows a frame whose key
+has not changed from memory rather than rendering it again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compile.h"
+#include "display.h"
+#include "framecache.h"
+#include "mesh.h"
+#include "ml6.h"
+#include "options.h"
+#include "parser.h"
+#include "symtab.h"
+#include "writer.h"
+#include "y.tab.h"
+
+#define FNV_PRIME 1099511628211ULL
+
+struct frame_cache cache;
+struct frame_memory memory;
+
+static unsigned long long
+hash_bytes(unsigned long long h, void* data, long size)
+{
+  /*
+  Fold size bytes at data into h.
+
+  @param: unsigned long long h
+  @param: void* data
+  @param: long size
+
+  @return: unsigned long long
+  */
+  unsigned char* p = (unsigned char*)data;
+
+  while (size-- > 0)
+    h = (h ^ *p++) * FNV_PRIME;
+  return h;
+}
+
+static unsigned long long
+hash_string(unsigned long long h, char* s)
+{
+  /*
+  Fold s, including its terminator, into h. NULL hashes like "".
+
+  @param: unsigned long long h
+  @param: char* s
+
+  @return: unsigned long long
+  */
+  return s ? hash_bytes(h, s, strlen(s) + 1) : hash_bytes(h, "", 1);
+}
+
+static unsigned long long
+hash_file(unsigned long long h, char* file)
+{
+  /*
+  Fold the contents of file into h. A missing file hashes like an empty
+  one, which is also what obj_parser draws for it.
+
+  @param: unsigned long long h
+  @param: char* file
+
+  @return: unsigned long long
+  */
+  FILE* f;
+  long n;
+  char buffer[65536];
+
+  h = hash_string(h, file);
+  f = fopen(file, "rb");
+  if (!f)
+    return h;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    h = hash_bytes(h, buffer, n);
+  fclose(f);
+  return h;
+}
+
+static unsigned long long
+hash_symbol(unsigned long long h, SYMTAB* s)
+{
+  /*
+  Fold a symbol into h by name, and by value for constants and lights.
+  Knob values change from frame to frame and are hashed by cache_key.
+
+  @param: unsigned long long h
+  @param: SYMTAB* s
+
+  @return: unsigned long long
+  */
+  if (!s)
+    return hash_bytes(h, "", 1);
+
+  h = hash_string(h, s->name);
+  if (s->type == SYM_CONSTANTS)
+    h = hash_bytes(h, s->s.c, sizeof(struct constants));
+  else if (s->type == SYM_LIGHT) {
+    /* the fourth components are not always set */
+    h = hash_bytes(h, s->s.l->l, 3 * sizeof(double));
+    h = hash_bytes(h, s->s.l->c, 3 * sizeof(double));
+  }
+  return h;
+}
+
+static unsigned long long
+hash_instruction(unsigned long long h, struct instruction* ins)
+{
+  /*
+  Fold everything an instruction draws with into h.
+
+  @param: unsigned long long h
+  @param: struct instruction* ins
+
+  @return: unsigned long long
+  */
+  int i, n;
+  char files[M_FILES][M_PATH];
+  struct command* cmd = &op[ins->index];
+
+  h = hash_bytes(h, &ins->opcode, sizeof(ins->opcode));
+  switch (ins->opcode) {
+    case TRANSFORM:
+      for (i = 0; i < 4; i++)
+        h = hash_bytes(h, ins->m->m[i], 4 * sizeof(double));
+      break;
+    case LIGHT:
+      h = hash_symbol(h, cmd->op.light.p);
+      h = hash_symbol(h, cmd->op.light.b);
+      break;
+    case SPHERE:
+      h = hash_symbol(h, cmd->op.sphere.constants);
+      h = hash_symbol(h, cmd->op.sphere.cs);
+      h = hash_bytes(h, cmd->op.sphere.d, sizeof(cmd->op.sphere.d));
+      h = hash_bytes(h, &cmd->op.sphere.r, sizeof(double));
+      break;
+    case TORUS:
+      h = hash_symbol(h, cmd->op.torus.constants);
+      h = hash_symbol(h, cmd->op.torus.cs);
+      h = hash_bytes(h, cmd->op.torus.d, sizeof(cmd->op.torus.d));
+      h = hash_bytes(h, &cmd->op.torus.r0, sizeof(double));
+      h = hash_bytes(h, &cmd->op.torus.r1, sizeof(double));
+      break;
+    case BOX:
+      h = hash_symbol(h, cmd->op.box.constants);
+      h = hash_symbol(h, cmd->op.box.cs);
+      h = hash_bytes(h, cmd->op.box.d0, sizeof(cmd->op.box.d0));
+      h = hash_bytes(h, cmd->op.box.d1, sizeof(cmd->op.box.d1));
+      break;
+    case LINE:
+      h = hash_symbol(h, cmd->op.line.cs0);
+      h = hash_symbol(h, cmd->op.line.cs1);
+      h = hash_bytes(h, cmd->op.line.p0, sizeof(cmd->op.line.p0));
+      h = hash_bytes(h, cmd->op.line.p1, sizeof(cmd->op.line.p1));
+      break;
+    case MESH:
+      h = hash_symbol(h, cmd->op.mesh.constants);
+      h = hash_symbol(h, cmd->op.mesh.cs);
+      h = hash_file(h, cmd->op.mesh.name);
+      n = mesh_files(cmd->op.mesh.name, files, M_FILES);
+      for (i = 0; i < n; i++)
+        h = hash_file(h, files[i]);
+      break;
+    case TEXTURE:
+      h = hash_symbol(h, cmd->op.texture.cs);
+      h = hash_file(h, cmd->op.texture.p->name);
+      h = hash_bytes(h, cmd->op.texture.d0, sizeof(cmd->op.texture.d0));
+      h = hash_bytes(h, cmd->op.texture.d1, sizeof(cmd->op.texture.d1));
+      h = hash_bytes(h, cmd->op.texture.d2, sizeof(cmd->op.texture.d2));
+      h = hash_bytes(h, cmd->op.texture.d3, sizeof(cmd->op.texture.d3));
+      break;
+    case MOVE:
+      h = hash_symbol(h, cmd->op.move.p);
+      h = hash_bytes(h, cmd->op.move.d, sizeof(cmd->op.move.d));
+      break;
+    case SCALE:
+      h = hash_symbol(h, cmd->op.scale.p);
+      h = hash_bytes(h, cmd->op.scale.d, sizeof(cmd->op.scale.d));
+      break;
+    case ROTATE:
+      h = hash_symbol(h, cmd->op.rotate.p);
+      h = hash_bytes(h, &cmd->op.rotate.axis, sizeof(double));
+      h = hash_bytes(h, &cmd->op.rotate.degrees, sizeof(double));
+      break;
+    case SAVE_COORDS:
+      h = hash_symbol(h, cmd->op.save_coordinate_system.p);
+      if (ins->m != NULL)
+        for (i = 0; i < 4; i++)
+          h = hash_bytes(h, ins->m->m[i], 4 * sizeof(double));
+      break;
+    case SAVE:
+      h = hash_symbol(h, cmd->op.save.p);
+      break;
+    case SHADING:
+      h = hash_symbol(h, cmd->op.shading.p);
+      break;
+  }
+  return h;
+}
+
+static unsigned long long
+image_key(int f)
+{
+  /*
+  Key of the image frame f has on disk, or is about to have once the writer
+  has saved it: the one queued in this run, or else the manifest's.
+
+  @param: int f
+
+  @return: unsigned long long
+  */
+  return cache.pending[f] ? cache.pending[f] : cache.done[f];
+}
+
+static void
+remember(int f, unsigned long long key)
+{
+  /*
+  Note that frame f has key in the table used to find duplicates. The
+  first frame seen with a key is kept, unless its image has since been
+  given a different key.
+
+  @param: int f
+  @param: unsigned long long key
+
+  @return: void
+  */
+  int i = key & (cache.size - 1);
+
+  while (cache.keys[i] && cache.keys[i] != key)
+    i = (i + 1) & (cache.size - 1);
+  if (!cache.keys[i] || image_key(cache.frames[i]) != key) {
+    cache.keys[i] = key;
+    cache.frames[i] = f;
+  }
+}
+
+void
+cache_open()
+{
+  /*
+  Hash the compiled program and load the manifest of earlier runs. Frames
+  are only cached on disk when each one is saved to its own file in anim/,
+  and otherwise only kept in memory under --watch.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i, f, on_disk;
+  int version = CACHE_VERSION;
+  int resolution[3] = { XRES, YRES, DEPTH_FORMAT };
+  unsigned long long key;
+  char file[256];
+  FILE* manifest;
+
+  memset(&cache, 0, sizeof(cache));
+  memory.recalled = 0;
+  if (opts.force)
+    return;
+  on_disk = !opts.headless && !opts.stream && !opts.preview && num_frames > 1;
+  if (!on_disk && !opts.watch)
+    return;
+
+  cache.program = hash_bytes(CHECKSUM_SEED, &version, sizeof(version));
+  cache.program = hash_bytes(cache.program, resolution, sizeof(resolution));
+  cache.program = hash_string(cache.program, opts.format);
+  cache.program = hash_bytes(cache.program, &opts.msaa, sizeof(opts.msaa));
+  cache.program =
+    hash_bytes(cache.program, &opts.raster, sizeof(opts.raster));
+  cache.program =
+    hash_bytes(cache.program, &opts.shadows, sizeof(opts.shadows));
+  for (i = 0; i < lastinst; i++)
+    cache.program = hash_instruction(cache.program, &program[i]);
+  if (!on_disk)
+    return;
+
+  cache.done = (unsigned long long*)calloc(num_frames, sizeof(*cache.done));
+  cache.pending =
+    (unsigned long long*)calloc(num_frames, sizeof(*cache.pending));
+  for (cache.size = 16; cache.size < 2 * num_frames; cache.size *= 2)
+    ;
+  cache.keys = (unsigned long long*)calloc(cache.size, sizeof(*cache.keys));
+  cache.frames = (int*)calloc(cache.size, sizeof(*cache.frames));
+
+  sprintf(file, "anim/.%s.manifest", name);
+  manifest = fopen(file, "r");
+  if (manifest) {
+    while (fscanf(manifest, "%d %llx", &f, &key) == 2) {
+      if (f >= 0 && f < num_frames) {
+        cache.done[f] = key;
+        remember(f, key);
+      }
+    }
+    fclose(manifest);
+  }
+
+  cache.manifest = fopen(file, "a");
+  if (!cache.manifest) {
+    printf("Warning: could not open %s, frames will not be cached\n", file);
+    return;
+  }
+  cache.enabled = 1;
+}
+
+unsigned long long
+cache_key(double* knobs, int count)
+{
+  /*
+  Key for the frame about to be rendered: the program hash together with
+  the frame's row of the knob table, which lists the knobs in the same
+  order for every frame. Never 0, which marks an empty slot.
+
+  @param: double* knobs
+  @param: int count
+
+  @return: unsigned long long
+  */
+  unsigned long long key;
+
+  key = hash_bytes(cache.program, knobs, count * sizeof(double));
+  return key ? key : 1;
+}
+
+int
+cache_lookup(int f, unsigned long long key)
+{
+  /*
+  Decide whether frame f, whose key is key, has to be rendered. Returns 1
+  if its image is already up to date or could be hardlinked from a frame
+  with the same key, 0 if it has to be rendered, in which case the frame is
+  recorded in the manifest once the writer has saved it.
+
+  @param: int f
+  @param: unsigned long long key
+
+  @return: int
+  */
+  int i;
+  char file[256], source[256];
+
+  if (!cache.enabled)
+    return 0;
+
+  frame_file(file, f);
+  if (cache.done[f] == key && access(file, F_OK) == 0) {
+    cache.skipped++;
+    return 1;
+  }
+
+  i = key & (cache.size - 1);
+  while (cache.keys[i] && cache.keys[i] != key)
+    i = (i + 1) & (cache.size - 1);
+
+  /* only link to an image that still has this key */
+  if (cache.keys[i] && cache.frames[i] != f &&
+      image_key(cache.frames[i]) == key) {
+    /* the source may still be in the writer's queue */
+    writer_flush();
+    frame_file(source, cache.frames[i]);
+    unlink(file);
+    if (link(source, file) == 0) {
+      cache.pending[f] = key;
+      cache_record(f);
+      cache.linked++;
+      return 1;
+    }
+  }
+
+  remember(f, key);
+  cache.pending[f] = key;
+  return 0;
+}
+
+void
+cache_record(int f)
+{
+  /*
+  Append frame f to the manifest now that its image is on disk. Called from
+  the writer thread, one short append per frame.
+
+  @param: int f
+
+  @return: void
+  */
+  if (!cache.enabled || f < 0 || !cache.pending[f])
+    return;
+
+  fprintf(cache.manifest, "%d %016llx\n", f, cache.pending[f]);
+  fflush(cache.manifest);
+  cache.done[f] = cache.pending[f];
+}
+
+static void
+rewrite_manifest()
+{
+  /*
+  Replace the manifest with the key of every frame that has an image. Keys
+  other processes (--shard) appended for frames this run did not save are
+  kept.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int f;
+  unsigned long long key;
+  char file[256], temp[300];
+  FILE* manifest;
+
+  sprintf(file, "anim/.%s.manifest", name);
+  manifest = fopen(file, "r");
+  if (manifest) {
+    while (fscanf(manifest, "%d %llx", &f, &key) == 2)
+      if (f >= 0 && f < num_frames && !cache.pending[f])
+        cache.done[f] = key;
+    fclose(manifest);
+  }
+
+  sprintf(temp, "%s.%d.tmp", file, (int)getpid());
+  manifest = fopen(temp, "w");
+  if (!manifest)
+    return;
+  for (f = 0; f < num_frames; f++)
+    if (cache.done[f])
+      fprintf(manifest, "%d %016llx\n", f, cache.done[f]);
+  if (fclose(manifest) != 0 || rename(temp, file) != 0)
+    unlink(temp);
+}
+
+void
+cache_close()
+{
+  /*
+  Report what was reused and release the cache. The writer must be stopped
+  first.
+
+  @param: No parameters
+
+  @return: void
+  */
+  if (cache.enabled) {
+    if (cache.skipped || cache.linked)
+      printf("Cache: %d frames unchanged, %d hardlinked\n",
+             cache.skipped,
+             cache.linked);
+    fclose(cache.manifest);
+    rewrite_manifest();
+  }
+  if (memory.recalled)
+    printf("Cache: %d frames unchanged in memory\n", memory.recalled);
+
+  free(cache.done);
+  free(cache.pending);
+  free(cache.keys);
+  free(cache.frames);
+  memset(&cache, 0, sizeof(cache));
+}
+
+static int
+remembering()
+{
+  /*
+  Whether frames are kept in memory in this run: under --watch, when they
+  are not cached on disk.
+
+  @param: No parameters
+
+  @return: int
+  */
+  return opts.watch && !opts.force && !cache.enabled;
+}
+
+int
+memory_recall(int f, unsigned long long key, screen s)
+{
+  /*
+  If frame f had key in the last run that kept it, put its image in s and
+  return 1, otherwise return 0. Pixels are 0..255 once a frame is drawn, so
+  the image comes back exactly as it was rendered.
+
+  @param: int f
+  @param: unsigned long long key
+  @param: screen s
+
+  @return: int
+  */
+  unsigned char* rgb;
+  int x, y;
+
+  if (!remembering() || f >= memory.frames || memory.keys[f] != key ||
+      !memory.images[f])
+    return 0;
+
+  rgb = memory.images[f];
+  for (y = 0; y < YRES; y++) {
+    for (x = 0; x < XRES; x++) {
+      s[x][y].red = *rgb++;
+      s[x][y].green = *rgb++;
+      s[x][y].blue = *rgb++;
+    }
+  }
+  memory.recalled++;
+  return 1;
+}
+
+void
+memory_store(int f, unsigned long long key, screen s)
+{
+  /*
+  Keep the image s of frame f, whose key is key, for the next run. A frame
+  that does not fit in MEMORY_BUDGET is forgotten, so it is rendered again.
+
+  @param: int f
+  @param: unsigned long long key
+  @param: screen s
+
+  @return: void
+  */
+  long size = XRES * YRES * 3;
+  int i;
+
+  if (!remembering())
+    return;
+
+  if (f >= memory.frames) {
+    memory.keys = (unsigned long long*)realloc(
+      memory.keys, (f + 1) * sizeof(*memory.keys));
+    memory.images = (unsigned char**)realloc(
+      memory.images, (f + 1) * sizeof(*memory.images));
+    for (i = memory.frames; i <= f; i++) {
+      memory.keys[i] = 0;
+      memory.images[i] = NULL;
+    }
+    memory.frames = f + 1;
+  }
+
+  if (!memory.images[f]) {
+    if (memory.bytes + size > MEMORY_BUDGET) {
+      memory.keys[f] = 0;
+      return;
+    }
+    memory.images[f] = (unsigned char*)malloc(size);
+    memory.bytes += size;
+  }
+  pack_rgb24(s, memory.images[f]);
+  memory.keys[f] = key;
+}
@@ -0,0 +1,62 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include <stdio.h>
+
+#include "ml6.h"
+
+#define CACHE_VERSION 1
+/* bytes of images --watch keeps from one run to the next */
+#define MEMORY_BUDGET (256L << 20)
+
+struct frame_cache
+{
+  int enabled;
+  unsigned long long program;
+  unsigned long long* done;
+  unsigned long long* pending;
+
+  unsigned long long* keys;
+  int* frames;
+  int size;
+
+  FILE* manifest;
+  int skipped, linked;
+};
+
+/* the frames of the last --watch run, for when they are not saved to anim/ */
+struct frame_memory
+{
+  int frames;
+  unsigned long long* keys;
+  /* XRES * YRES * 3 bytes each, as pack_rgb24 lays them out */
+  unsigned char** images;
+  long bytes;
+  int recalled;
+};
+
+extern struct frame_cache cache;
+extern struct frame_memory memory;
+
+void
+cache_open();
+
+unsigned long long
+cache_key(double*, int);
+
+int
+cache_lookup(int, unsigned long long);
+
+void
+cache_record(int);
+
+void
+cache_close();
+
+int
+memory_recall(int, unsigned long long, screen);
+
+void
+memory_store(int, unsigned long long, screen);
+
+#endif
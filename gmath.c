@@ -196,20 +196,20 @@ dot_product(double* a, double* b)
   return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
 }
 
-double*
-calculate_normal(struct matrix* polygons, int i)
+void
+calculate_normal(struct matrix* polygons, int i, double* N)
 {
   /*
-  Calculate the normal vector.
+  Calculate the normal vector of the triangle at i into N.
 
   @param: struct matrix* polygons
   @param: int i
+  @param: double* N
 
-  @return: double*
+  @return: void
   */
   double A[3];
   double B[3];
-  double* N = (double*)malloc(3 * sizeof(double));
 
   A[0] = polygons->m[0][i + 1] - polygons->m[0][i];
   A[1] = polygons->m[1][i + 1] - polygons->m[1][i];
@@ -222,6 +222,4 @@ calculate_normal(struct matrix* polygons, int i)
   N[0] = A[1] * B[2] - A[2] * B[1];
   N[1] = A[2] * B[0] - A[0] * B[2];
   N[2] = A[0] * B[1] - A[1] * B[0];
-
-  return N;
 }
@@ -39,7 +39,7 @@ normalize(double*);
 double
 dot_product(double*, double*);
 
-double*
-calculate_normal(struct matrix*, int);
+void
+calculate_normal(struct matrix*, int, double*);
 
 #endif
@@ -0,0 +1,143 @@
+/*
+Keeps a single copy of every string seen by the lexer. Identical strings share
+the same pointer, and the characters themselves live in large pooled blocks
+instead of one malloc per string or a fixed size buffer per command.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+struct block
+{
+  struct block* next;
+  int used, size;
+  char data[];
+};
+
+static struct block* blocks = NULL;
+static char** table = NULL;
+static int buckets = 0;
+static int count = 0;
+
+unsigned int
+intern_hash_bytes(void* data, long size)
+{
+  /*
+  FNV-1a hash of size bytes at data.
+
+  @param: void* data
+  @param: long size
+
+  @return: unsigned int
+  */
+  unsigned char* p = (unsigned char*)data;
+  unsigned int h = 2166136261u;
+
+  while (size-- > 0) {
+    h ^= *p++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+unsigned int
+intern_hash(char* s)
+{
+  /*
+  FNV-1a hash of the string s.
+
+  @param: char* s
+
+  @return: unsigned int
+  */
+  return intern_hash_bytes(s, strlen(s));
+}
+
+static char*
+pool_copy(char* s)
+{
+  /*
+  Copy s into the current block, starting a new one when it is full.
+
+  @param: char* s
+
+  @return: char*
+  */
+  int len = strlen(s) + 1;
+  int size;
+  char* copy;
+
+  if (blocks == NULL || blocks->used + len > blocks->size) {
+    size = len > INTERN_BLOCK ? len : INTERN_BLOCK;
+    struct block* b = (struct block*)malloc(sizeof(struct block) + size);
+    b->next = blocks;
+    b->used = 0;
+    b->size = size;
+    blocks = b;
+  }
+
+  copy = blocks->data + blocks->used;
+  memcpy(copy, s, len);
+  blocks->used += len;
+
+  return copy;
+}
+
+static void
+grow_table()
+{
+  /*
+  Double the number of buckets and rehash every interned string.
+
+  @param: No parameters
+
+  @return: void
+  */
+  char** old = table;
+  int old_buckets = buckets;
+  int i, j;
+
+  buckets = buckets ? buckets * 2 : INTERN_BUCKETS;
+  table = (char**)calloc(buckets, sizeof(char*));
+
+  for (i = 0; i < old_buckets; i++) {
+    if (old[i]) {
+      j = intern_hash(old[i]) & (buckets - 1);
+      while (table[j])
+        j = (j + 1) & (buckets - 1);
+      table[j] = old[i];
+    }
+  }
+  free(old);
+}
+
+char*
+intern(char* s)
+{
+  /*
+  Return the shared copy of s, adding it to the table if it is new.
+
+  @param: char* s
+
+  @return: char*
+  */
+  int i;
+
+  if (2 * (count + 1) > buckets)
+    grow_table();
+
+  i = intern_hash(s) & (buckets - 1);
+  while (table[i]) {
+    if (!strcmp(table[i], s))
+      return table[i];
+    i = (i + 1) & (buckets - 1);
+  }
+
+  table[i] = pool_copy(s);
+  count++;
+
+  return table[i];
+}
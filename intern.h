@@ -0,0 +1,16 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#define INTERN_BUCKETS 256
+#define INTERN_BLOCK 4096
+
+unsigned int
+intern_hash_bytes(void*, long);
+
+unsigned int
+intern_hash(char*);
+
+char*
+intern(char*);
+
+#endif
@@ -1,7 +1,9 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "arena.h"
 #include "matrix.h"
 
 struct matrix*
@@ -118,44 +120,74 @@ make_translate(double x, double y, double z)
   Return the translation matrix created using x, y and z as the translation
   offsets.
 
-  @param: int x
-  @param: int y
-  @param: int z
+  @param: double x
+  @param: double y
+  @param: double z
 
   @return: struct matrix*
   */
   struct matrix* t = new_matrix(4, 4);
 
+  set_translate(t, x, y, z);
+  return t;
+}
+
+void
+set_translate(struct matrix* t, double x, double y, double z)
+{
+  /*
+  Make t the translation matrix with offsets x, y and z, in place.
+
+  @param: struct matrix* t
+  @param: double x
+  @param: double y
+  @param: double z
+
+  @return: void
+  */
   ident(t);
 
   t->m[0][3] = x;
   t->m[1][3] = y;
   t->m[2][3] = z;
-
-  return t;
 }
 
 struct matrix*
 make_scale(double x, double y, double z)
 {
   /*
-  Return the translation matrix creates using x, y and z as the scale factors
+  Return the scale matrix created using x, y and z as the scale factors.
 
-  @param: int x
-  @param: int y
-  @param: int z
+  @param: double x
+  @param: double y
+  @param: double z
 
   @return: struct matrix*
   */
   struct matrix* t = new_matrix(4, 4);
 
+  set_scale(t, x, y, z);
+  return t;
+}
+
+void
+set_scale(struct matrix* t, double x, double y, double z)
+{
+  /*
+  Make t the scale matrix with factors x, y and z, in place.
+
+  @param: struct matrix* t
+  @param: double x
+  @param: double y
+  @param: double z
+
+  @return: void
+  */
   ident(t);
 
   t->m[0][0] = x;
   t->m[1][1] = y;
   t->m[2][2] = z;
-
-  return t;
 }
 
 struct matrix*
@@ -171,14 +203,27 @@ make_rotX(double theta)
   */
   struct matrix* t = new_matrix(4, 4);
 
+  set_rotX(t, theta);
+  return t;
+}
+
+void
+set_rotX(struct matrix* t, double theta)
+{
+  /*
+  Make t the rotation by theta about the X axis, in place.
+
+  @param: struct matrix* t
+  @param: double theta
+
+  @return: void
+  */
   ident(t);
 
   t->m[1][1] = cos(theta);
   t->m[1][2] = -1 * sin(theta);
   t->m[2][1] = sin(theta);
   t->m[2][2] = cos(theta);
-
-  return t;
 }
 
 struct matrix*
@@ -194,14 +239,27 @@ make_rotY(double theta)
   */
   struct matrix* t = new_matrix(4, 4);
 
+  set_rotY(t, theta);
+  return t;
+}
+
+void
+set_rotY(struct matrix* t, double theta)
+{
+  /*
+  Make t the rotation by theta about the Y axis, in place.
+
+  @param: struct matrix* t
+  @param: double theta
+
+  @return: void
+  */
   ident(t);
 
   t->m[0][0] = cos(theta);
   t->m[2][0] = -1 * sin(theta);
   t->m[0][2] = sin(theta);
   t->m[2][2] = cos(theta);
-
-  return t;
 }
 
 struct matrix*
@@ -217,14 +275,27 @@ make_rotZ(double theta)
   */
   struct matrix* t = new_matrix(4, 4);
 
+  set_rotZ(t, theta);
+  return t;
+}
+
+void
+set_rotZ(struct matrix* t, double theta)
+{
+  /*
+  Make t the rotation by theta about the Z axis, in place.
+
+  @param: struct matrix* t
+  @param: double theta
+
+  @return: void
+  */
   ident(t);
 
   t->m[0][0] = cos(theta);
   t->m[0][1] = -1 * sin(theta);
   t->m[1][0] = sin(theta);
   t->m[1][1] = cos(theta);
-
-  return t;
 }
 
 void
@@ -320,6 +391,35 @@ new_matrix(int rows, int cols)
   m->rows = rows;
   m->cols = cols;
   m->lastcol = 0;
+  m->arena = NULL;
+
+  return m;
+}
+
+struct matrix*
+arena_matrix(struct arena* a, int rows, int cols)
+{
+  /*
+  Return a matrix allocated from a, which lasts until a is reset.
+  free_matrix leaves it alone, and grow_matrix takes new rows from a.
+
+  @param: struct arena* a
+  @param: int rows
+  @param: int cols
+
+  @return: struct matrix*
+  */
+  struct matrix* m;
+  int i;
+
+  m = (struct matrix*)arena_alloc(a, sizeof(struct matrix));
+  m->m = (double**)arena_alloc(a, rows * sizeof(double*));
+  for (i = 0; i < rows; i++)
+    m->m[i] = (double*)arena_alloc(a, (long)cols * sizeof(double));
+  m->rows = rows;
+  m->cols = cols;
+  m->lastcol = 0;
+  m->arena = a;
 
   return m;
 }
@@ -335,6 +435,9 @@ free_matrix(struct matrix* m)
   @return: void
   */
   int i;
+
+  if (m->arena)
+    return;
   for (i = 0; i < m->rows; i++) {
     free(m->m[i]);
   }
@@ -355,9 +458,17 @@ grow_matrix(struct matrix* m, int newcols)
   @return: void
   */
   int i;
+  double* row;
 
   for (i = 0; i < m->rows; i++) {
-    m->m[i] = realloc(m->m[i], newcols * sizeof(double));
+    if (m->arena) {
+      row = (double*)arena_alloc(m->arena, (long)newcols * sizeof(double));
+      memcpy(row,
+             m->m[i],
+             (m->cols < newcols ? m->cols : newcols) * sizeof(double));
+      m->m[i] = row;
+    } else
+      m->m[i] = realloc(m->m[i], newcols * sizeof(double));
   }
 
   m->cols = newcols;
@@ -4,11 +4,15 @@
 #define HERMITE 0
 #define BEZIER 1
 
+struct arena;
+
 struct matrix
 {
   double** m;
   int rows, cols;
   int lastcol;
+  /* the arena it was allocated from, or NULL if it came from malloc */
+  struct arena* arena;
 } matrix;
 
 struct matrix*
@@ -35,9 +39,27 @@ make_rotY(double);
 struct matrix*
 make_rotZ(double);
 
+void
+set_translate(struct matrix*, double, double, double);
+
+void
+set_scale(struct matrix*, double, double, double);
+
+void
+set_rotX(struct matrix*, double);
+
+void
+set_rotY(struct matrix*, double);
+
+void
+set_rotZ(struct matrix*, double);
+
 struct matrix*
 new_matrix(int, int);
 
+struct matrix*
+arena_matrix(struct arena*, int, int);
+
 void
 free_matrix(struct matrix*);
 
@@ -4,16 +4,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include "parser.h"
+#include "batch.h"
 #include "matrix.h"
+#include "meshcache.h"
+#include "options.h"
+#include "perfctr.h"
+#include "preview.h"
+#include "server.h"
+#include "stream.h"
+#include "texture.h"
+#include "watch.h"
 
 #define YYERROR_VERBOSE 1
 
   SYMTAB *s;
   struct light *l;
   struct constants *c;
-  struct command op[MAX_COMMANDS];
+  struct command *op=NULL;
   struct matrix *m;
   int lastop=0;
+  int maxop=0;
   int lineno=0;
   %}
 
@@ -22,7 +32,7 @@
 
 %union{
   double val;
-  char string[255];
+  char *string;
 }
 
 %token COMMENT
@@ -38,8 +48,14 @@
 %%
 /* Grammar rules */
 
-input:
-| input command
+input: { grow_ops(); }
+| input command {
+  if (symtab_failed) {
+    yyerror("too many symbols");
+    YYABORT;
+  }
+  grow_ops();
+}
 ;
 
 command:
@@ -396,7 +412,7 @@ MESH CO STRING
 {
   lineno++;
   op[lastop].opcode = MESH;
-  strcpy(op[lastop].op.mesh.name,$3);
+  op[lastop].op.mesh.name = $3;
   op[lastop].op.mesh.constants = NULL;
   op[lastop].op.mesh.cs = NULL;
   lastop++;
@@ -405,7 +421,7 @@ MESH STRING CO STRING
 { /* name and constants */
   lineno++;
   op[lastop].opcode = MESH;
-  strcpy(op[lastop].op.mesh.name,$4);
+  op[lastop].op.mesh.name = $4;
   c = (struct constants *)malloc(sizeof(struct constants));
   op[lastop].op.mesh.constants = add_symbol($2,SYM_CONSTANTS,c);
   op[lastop].op.mesh.cs = NULL;
@@ -415,7 +431,7 @@ MESH STRING CO STRING STRING
 {
   lineno++;
   op[lastop].opcode = MESH;
-  strcpy(op[lastop].op.mesh.name,$4);
+  op[lastop].op.mesh.name = $4;
   c = (struct constants *)malloc(sizeof(struct constants));
   op[lastop].op.mesh.constants = add_symbol($2,SYM_CONSTANTS,c);
   m = (struct matrix *)new_matrix(4,4);
@@ -792,6 +808,32 @@ GENERATE_RAYFILES
 
 
 /* Other C stuff */
+void grow_ops()
+{
+  /*
+  Makes sure op has room for at least one more command. The buffer starts
+  at OP_CHUNK commands and doubles whenever it fills up, so memory stays
+  proportional to the number of commands in the script. New commands are
+  zeroed, since some rules leave optional fields unset.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int old = maxop;
+
+  if (lastop < maxop)
+    return;
+
+  maxop = maxop ? maxop * 2 : OP_CHUNK;
+  op = (struct command *)realloc(op, maxop * sizeof(struct command));
+  if (op == NULL) {
+    printf("Error: out of memory after %d commands\n", lastop);
+    exit(-1);
+  }
+  memset(op + old, 0, (maxop - old) * sizeof(struct command));
+}
+
 int yyerror(char *s)
 {
   printf("Error in line %d:%s\n",lineno,s);
@@ -804,16 +846,62 @@ int yywrap()
 }
 
 
-extern FILE *yyin;
+void reset_parser()
+{
+  /*
+  Forget the commands and symbols of the last script parsed, so the next
+  one starts from nothing. The op buffer is kept for it.
 
+  @param: No parameters
 
-int main(int argc, char **argv) {
+  @return: void
+  */
+  memset(op, 0, maxop * sizeof(struct command));
+  lastop = 0;
+  lineno = 0;
+  clear_symtab();
+  num_frames = 1;
+  name[0] = '\0';
+}
 
-  yyin = fopen(argv[1],"r");
 
-  yyparse();
-  
-  script();
+int main(int argc, char **argv) {
 
-  return 0;
+  int failed = 0;
+
+  parse_options(argc, argv);
+  perf_open();
+  if (opts.stream && !opts.headless)
+    stream_open(opts.stream, opts.stream_format);
+  if (opts.preview)
+    preview_open(opts.preview);
+  if (opts.watch)
+    watch_start();
+  if (opts.server)
+    serve(opts.server);
+
+  if (opts.script_count > 1)
+    failed = batch();
+  else {
+    while (1) {
+      if (!run_script(opts.script) && (!opts.watch || out.failed)) {
+        failed = 1;
+        break;
+      }
+
+      if (!opts.watch)
+        break;
+      watch_files();
+      mesh_sweep(1);
+      watch_wait();
+      reset_parser();
+    }
+  }
+
+  stream_close();
+  preview_close();
+  perf_close();
+  free_textures();
+  free_meshes();
+  return failed ? 1 : 0;
 }
@@ -5,6 +5,7 @@
 #include "draw.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "texture.h"
 
 char**
 process_line(char* line)
@@ -16,23 +17,15 @@ process_line(char* line)
 
   @return: char**
   */
-  char* processed;
-  char** tokens = calloc(sizeof(char*), 10);
+  char** tokens = calloc(sizeof(char*), M_TOKENS);
 
   int i = 0;
 
-  while (line) {
+  while (line && i < M_TOKENS - 1) {
     tokens[i] = strsep(&line, " ");
 
-    if (strcmp(tokens[i], "")) {
-      processed = calloc(sizeof(char), 1);
-
-      strcpy(processed, strsep(&tokens[i], "/"));
-
-      tokens[i] = processed;
-
+    if (strcmp(tokens[i], ""))
       i++;
-    }
   }
 
   return tokens;
@@ -65,15 +58,52 @@ add_mesh_point(struct matrix* points, double vals[4], int type)
   points->lastcol += 1;
 }
 
+static void
+add_mesh_uv(struct matrix* uvs,
+            struct matrix* vt,
+            struct matrix* ft,
+            int face,
+            int corner)
+{
+  /*
+  Add the texture coordinates of one corner of a face to uvs, or no
+  texture if the face has none.
+
+  @param: struct matrix* uvs
+  @param: struct matrix* vt
+  @param: struct matrix* ft
+  @param: int face
+  @param: int corner
+
+  @return: void
+  */
+  int t = ((int)ft->m[corner][face]) - 1;
+  int texture = (int)ft->m[M_CORNERS][face];
+
+  if (texture == NO_TEXTURE || t < 0 || t >= vt->lastcol)
+    add_uv(uvs, 0, 0, NO_TEXTURE);
+  else
+    add_uv(uvs, vt->m[0][t], vt->m[1][t], texture);
+}
+
 void
-add_mesh(struct matrix* polygons, struct matrix* v, struct matrix* f)
+add_mesh(struct matrix* polygons,
+         struct matrix* uvs,
+         struct matrix* v,
+         struct matrix* f,
+         struct matrix* vt,
+         struct matrix* ft)
 {
   /*
-  Add the vertices and faces to polygons.
+  Add the vertices and faces to polygons, and their texture coordinates
+  to uvs if it is not NULL.
 
-  @param: struct matrix* polygons,
+  @param: struct matrix* polygons
+  @param: struct matrix* uvs
   @param: struct matrix* v
   @param: struct matrix* f
+  @param: struct matrix* vt
+  @param: struct matrix* ft
 
   @return: void
   */
@@ -99,6 +129,11 @@ add_mesh(struct matrix* polygons, struct matrix* v, struct matrix* f)
                 v->m[0][v2],
                 v->m[1][v2],
                 v->m[2][v2]);
+    if (uvs) {
+      add_mesh_uv(uvs, vt, ft, i, 0);
+      add_mesh_uv(uvs, vt, ft, i, 1);
+      add_mesh_uv(uvs, vt, ft, i, 2);
+    }
 
     if (v3 > 0) {
       add_polygon(polygons,
@@ -111,33 +146,159 @@ add_mesh(struct matrix* polygons, struct matrix* v, struct matrix* f)
                   v->m[0][v3],
                   v->m[1][v3],
                   v->m[2][v3]);
+      if (uvs) {
+        add_mesh_uv(uvs, vt, ft, i, 0);
+        add_mesh_uv(uvs, vt, ft, i, 2);
+        add_mesh_uv(uvs, vt, ft, i, 3);
+      }
     }
   }
 
   free_matrix(v);
   free_matrix(f);
+  free_matrix(vt);
+  free_matrix(ft);
+}
+
+static void
+relative_path(char* path, char* from, char* name)
+{
+  /*
+  Put the path of name, taken relative to the directory of the file from,
+  into path (M_PATH bytes).
+
+  @param: char* path
+  @param: char* from
+  @param: char* name
+
+  @return: void
+  */
+  char* slash = strrchr(from, '/');
+
+  if (name[0] == '/' || !slash)
+    snprintf(path, M_PATH, "%s", name);
+  else
+    snprintf(path, M_PATH, "%.*s/%s", (int)(slash - from), from, name);
+}
+
+static int
+load_materials(char* file,
+               char names[M_MATERIALS][M_NAME],
+               int* maps,
+               int count)
+{
+  /*
+  Read the materials of an MTL library, keeping the name and texture
+  (map_Kd) of each. Only textures are used; the colors of the mesh come
+  from its constants. Returns the number of materials known afterwards.
+
+  @param: char* file
+  @param: char names[M_MATERIALS][M_NAME]
+  @param: int* maps
+  @param: int count
+
+  @return: int
+  */
+  FILE* fs;
+  char line[256];
+  char name[M_NAME];
+  char map[256];
+  char path[M_PATH];
+
+  fs = fopen(file, "r");
+  if (fs == NULL)
+    return count;
+
+  while (fgets(line, sizeof(line), fs)) {
+    if (sscanf(line, " newmtl %63s", name) == 1 && count < M_MATERIALS) {
+      strcpy(names[count], name);
+      maps[count++] = NO_TEXTURE;
+    } else if (sscanf(line, " map_Kd %255s", map) == 1 && count > 0) {
+      relative_path(path, file, map);
+      maps[count - 1] = load_texture(path);
+    }
+  }
+
+  fclose(fs);
+  return count;
+}
+
+int
+mesh_files(char* file, char files[][M_PATH], int max)
+{
+  /*
+  List the files an OBJ reads besides itself: the MTL libraries it names
+  with mtllib, and the images (map_Kd) those libraries name. Returns how
+  many were put in files, at most max.
+
+  @param: char* file
+  @param: char files[][M_PATH]
+  @param: int max
+
+  @return: int
+  */
+  FILE* fs;
+  FILE* mtl;
+  char line[256];
+  char name[256];
+  int count = 0, libraries, i;
+
+  fs = fopen(file, "r");
+  if (fs == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), fs) && count < max)
+    if (sscanf(line, "mtllib %255s", name) == 1)
+      relative_path(files[count++], file, name);
+  fclose(fs);
+
+  libraries = count;
+  for (i = 0; i < libraries; i++) {
+    mtl = fopen(files[i], "r");
+    if (mtl == NULL)
+      continue;
+    while (fgets(line, sizeof(line), mtl) && count < max)
+      if (sscanf(line, " map_Kd %255s", name) == 1)
+        relative_path(files[count++], files[i], name);
+    fclose(mtl);
+  }
+  return count;
 }
 
 void
-obj_parser(struct matrix* polygons, char* file)
+obj_parser(struct matrix* polygons, struct matrix* uvs, char* file)
 {
   /*
-  Parse OBJ format and add its polygons.
+  Parse OBJ format and add its polygons. If uvs is not NULL, the texture
+  coordinates of every point go into it: faces with vt indices, drawn
+  with a material from the mtllib that has a map_Kd image, are textured.
 
   @param: struct matrix* polygons
+  @param: struct matrix* uvs
   @param: char* file
 
   @return: void
   */
   struct matrix* v;
   struct matrix* f;
+  struct matrix* vt;
+  struct matrix* ft;
 
   v = new_matrix(3, M_SIZE);
   f = new_matrix(4, M_SIZE);
+  vt = new_matrix(3, M_SIZE);
+  ft = new_matrix(M_CORNERS + 1, M_SIZE);
 
   FILE* fs;
 
   fs = fopen(file, "r");
+  if (fs == NULL) {
+    printf("Error: could not open mesh %s\n", file);
+    free_matrix(v);
+    free_matrix(f);
+    free_matrix(vt);
+    free_matrix(ft);
+    return;
+  }
 
   int i;
 
@@ -149,6 +310,20 @@ obj_parser(struct matrix* polygons, char* file)
 
   char** args;
 
+  char* slash;
+
+  char names[M_MATERIALS][M_NAME];
+
+  int maps[M_MATERIALS];
+
+  int materials = 0;
+
+  int texture = NO_TEXTURE;
+
+  char name[M_PATH];
+
+  char path[M_PATH];
+
   while (fgets(line, sizeof(line), fs)) {
     line[strlen(line) - 1] = '\0';
 
@@ -156,23 +331,43 @@ obj_parser(struct matrix* polygons, char* file)
       args = process_line(line);
 
       i = 0;
+      vals[3] = 0;
+
+      if (ft->lastcol == ft->cols)
+        grow_matrix(ft, ft->lastcol + M_SIZE);
+      ft->m[3][ft->lastcol] = 0;
 
       while (args[i + 1] && i < 4) {
         vals[i] = atof(args[i + 1]);
+        slash = strchr(args[i + 1], '/');
+        ft->m[i][ft->lastcol] = slash ? atoi(slash + 1) : 0;
         i++;
       }
 
+      ft->m[M_CORNERS][ft->lastcol] = texture;
+      ft->lastcol++;
       add_mesh_point(f, vals, F);
+      free(args);
     } else if (!strncmp(line, "v", 1)) {
       sscanf(line, "%s %lf %lf %lf", type, vals, vals + 1, vals + 2);
 
       if (!strncmp(type, "v", strlen(type))) {
         add_mesh_point(v, vals, V);
+      } else if (!strcmp(type, "vt")) {
+        add_mesh_point(vt, vals, V);
       }
+    } else if (uvs && sscanf(line, "mtllib %255s", name) == 1) {
+      relative_path(path, file, name);
+      materials = load_materials(path, names, maps, materials);
+    } else if (uvs && sscanf(line, "usemtl %255s", name) == 1) {
+      texture = NO_TEXTURE;
+      for (i = 0; i < materials; i++)
+        if (!strcmp(names[i], name))
+          texture = maps[i];
     }
   }
 
-  free(args);
+  fclose(fs);
 
-  add_mesh(polygons, v, f);
+  add_mesh(polygons, uvs, v, f, vt, ft);
 }
@@ -7,15 +7,30 @@
 #define V 0
 #define F 1
 #define M_SIZE 128
+#define M_TOKENS 10
+#define M_CORNERS 4
+#define M_MATERIALS 64
+#define M_NAME 64
+#define M_PATH 512
+/* files an OBJ reads besides itself, see mesh_files */
+#define M_FILES 16
 
 char**
 process_line(char*);
 
 void
-obj_parser(struct matrix*, char*);
+obj_parser(struct matrix*, struct matrix*, char*);
+
+int
+mesh_files(char*, char[][M_PATH], int);
 
 void
-add_mesh(struct matrix*, struct matrix*, struct matrix*);
+add_mesh(struct matrix*,
+         struct matrix*,
+         struct matrix*,
+         struct matrix*,
+         struct matrix*,
+         struct matrix*);
 
 void
 add_mesh_point(struct matrix*, double[4], int);
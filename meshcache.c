@@ -0,0 +1,416 @@
+/*
+Keeps the polygons of OBJ meshes, spheres and tori once they have been made,
+so a mesh is parsed and a sphere or torus tessellated once per process
+instead of once per frame. Drawing one copies its untransformed polygons
+onto the end of the polygon matrix, which is then transformed and drawn like
+freshly generated ones.
+
+Spheres and tori are found by their parameters. Meshes are found by file
+name, and read again when the modification time or size of the file, or of
+an MTL library or texture it uses, has changed, so a long running process
+(--watch, --server) picks up edits. The files are checked the first time a
+mesh is drawn in each run, not on every draw. Entries are found through a
+hash of the file name or parameters. mesh_sweep drops whatever the last few
+runs did not draw.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "draw.h"
+#include "intern.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "meshcache.h"
+#include "texture.h"
+
+struct mesh_cache meshes;
+
+long long
+file_stamp(char* file)
+{
+  /*
+  Modification time and size of file folded into one number that changes
+  when the file is written, or -1 if it does not exist.
+
+  @param: char* file
+
+  @return: long long
+  */
+  struct stat st;
+
+  if (stat(file, &st) != 0)
+    return -1;
+  return ((long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec) ^
+         ((long long)st.st_size << 40);
+}
+
+static void
+append_columns(struct matrix* dst, struct matrix* src)
+{
+  /*
+  Copy every column of src onto the end of dst.
+
+  @param: struct matrix* dst
+  @param: struct matrix* src
+
+  @return: void
+  */
+  int r;
+
+  if (dst->lastcol + src->lastcol > dst->cols)
+    grow_matrix(dst, dst->lastcol + src->lastcol);
+  for (r = 0; r < src->rows && r < dst->rows; r++)
+    memcpy(dst->m[r] + dst->lastcol,
+           src->m[r],
+           src->lastcol * sizeof(double));
+  dst->lastcol += src->lastcol;
+}
+
+static void
+list_files(struct cached_mesh* c)
+{
+  /*
+  Make the list of files the OBJ file of c reads besides itself.
+
+  @param: struct cached_mesh* c
+
+  @return: void
+  */
+  char files[M_FILES][M_PATH];
+  int i;
+
+  for (i = 0; i < c->file_count; i++)
+    free(c->files[i]);
+  free(c->files);
+
+  c->file_count = mesh_files(c->file, files, M_FILES);
+  c->files = (char**)malloc(c->file_count * sizeof(char*));
+  for (i = 0; i < c->file_count; i++)
+    c->files[i] = strdup(files[i]);
+}
+
+static unsigned long long
+mesh_stamp(struct cached_mesh* c)
+{
+  /*
+  The stamps of the OBJ file of c and of the files it reads, folded into
+  one number that changes when any of them is written.
+
+  @param: struct cached_mesh* c
+
+  @return: unsigned long long
+  */
+  unsigned long long stamp = file_stamp(c->file);
+  int i;
+
+  for (i = 0; i < c->file_count; i++)
+    stamp = stamp * 1000003 ^ (unsigned long long)file_stamp(c->files[i]);
+  return stamp;
+}
+
+static unsigned int
+mesh_hash(int kind, char* file, double* params)
+{
+  /*
+  Hash of what an entry is found by: the file name of a mesh, or the kind
+  and params of a sphere or torus.
+
+  @param: int kind
+  @param: char* file
+  @param: double* params
+
+  @return: unsigned int
+  */
+  if (kind == CACHED_OBJ)
+    return intern_hash(file);
+  return intern_hash_bytes(params, CACHED_PARAMS * sizeof(double)) ^ kind;
+}
+
+static void
+index_meshes()
+{
+  /*
+  Rebuild the hash of the entries, with at least twice as many slots as
+  there are entries.
+
+  @param: No parameters
+
+  @return: void
+  */
+  struct cached_mesh* c;
+  int i, j;
+
+  if (meshes.capacity == 0)
+    return;
+  if (meshes.slot_count < 2 * meshes.capacity) {
+    for (meshes.slot_count = 32; meshes.slot_count < 2 * meshes.capacity;)
+      meshes.slot_count *= 2;
+    free(meshes.slots);
+    meshes.slots = (int*)malloc(meshes.slot_count * sizeof(int));
+  }
+  memset(meshes.slots, 0, meshes.slot_count * sizeof(int));
+
+  for (i = 0; i < meshes.count; i++) {
+    c = &meshes.list[i];
+    j = mesh_hash(c->kind, c->file, c->params) & (meshes.slot_count - 1);
+    while (meshes.slots[j])
+      j = (j + 1) & (meshes.slot_count - 1);
+    meshes.slots[j] = i + 1;
+  }
+}
+
+static struct cached_mesh*
+find_mesh(int kind, char* file, double* params)
+{
+  /*
+  Return the entry for a mesh file or for a sphere or torus with params,
+  or NULL if there is none.
+
+  @param: int kind
+  @param: char* file
+  @param: double* params
+
+  @return: struct cached_mesh*
+  */
+  int i;
+  struct cached_mesh* c;
+
+  if (meshes.count == 0)
+    return NULL;
+
+  i = mesh_hash(kind, file, params) & (meshes.slot_count - 1);
+  for (; meshes.slots[i]; i = (i + 1) & (meshes.slot_count - 1)) {
+    c = &meshes.list[meshes.slots[i] - 1];
+    if (c->kind != kind)
+      continue;
+    if (kind == CACHED_OBJ ? strcmp(c->file, file) == 0
+                           : memcmp(c->params,
+                                    params,
+                                    CACHED_PARAMS * sizeof(double)) == 0)
+      return c;
+  }
+  return NULL;
+}
+
+static struct cached_mesh*
+new_mesh(int kind, char* file, double* params)
+{
+  /*
+  Add an empty entry, checked in this run.
+
+  @param: int kind
+  @param: char* file
+  @param: double* params
+
+  @return: struct cached_mesh*
+  */
+  struct cached_mesh* c;
+  int i;
+
+  if (meshes.count == meshes.capacity) {
+    meshes.capacity = meshes.capacity ? 2 * meshes.capacity : 16;
+    meshes.list = (struct cached_mesh*)realloc(
+      meshes.list, meshes.capacity * sizeof(struct cached_mesh));
+    index_meshes();
+  }
+  c = &meshes.list[meshes.count++];
+  memset(c, 0, sizeof(struct cached_mesh));
+  c->kind = kind;
+  c->file = file ? strdup(file) : NULL;
+  memcpy(c->params, params, CACHED_PARAMS * sizeof(double));
+  c->polygons = new_matrix(4, 100);
+  c->checked = meshes.run;
+
+  i = mesh_hash(kind, file, params) & (meshes.slot_count - 1);
+  while (meshes.slots[i])
+    i = (i + 1) & (meshes.slot_count - 1);
+  meshes.slots[i] = meshes.count;
+  return c;
+}
+
+static void
+drop_mesh(struct cached_mesh* c)
+{
+  /*
+  Free what an entry holds.
+
+  @param: struct cached_mesh* c
+
+  @return: void
+  */
+  int i;
+
+  for (i = 0; i < c->file_count; i++)
+    free(c->files[i]);
+  free(c->files);
+  free(c->file);
+  free_matrix(c->polygons);
+  if (c->uvs)
+    free_matrix(c->uvs);
+}
+
+void
+mesh_polygons(struct matrix* polygons, struct matrix* uvs, char* file)
+{
+  /*
+  Add the polygons of an OBJ file to polygons, and their texture
+  coordinates to uvs, parsing the file only if it is new or, the first
+  time it is drawn in a run, has changed.
+
+  @param: struct matrix* polygons
+  @param: struct matrix* uvs
+  @param: char* file
+
+  @return: void
+  */
+  double params[CACHED_PARAMS] = { 0 };
+  struct cached_mesh* c = find_mesh(CACHED_OBJ, file, params);
+  int parse = 0;
+
+  if (!c) {
+    /* obj_parser reports the missing file */
+    if (file_stamp(file) < 0) {
+      obj_parser(polygons, uvs, file);
+      return;
+    }
+    c = new_mesh(CACHED_OBJ, file, params);
+    c->uvs = new_matrix(UV_ROWS, 100);
+    parse = 1;
+  } else if (c->checked != meshes.run) {
+    c->checked = meshes.run;
+    parse = c->stamp != mesh_stamp(c);
+  }
+
+  if (parse) {
+    /* the OBJ file may name other libraries now */
+    list_files(c);
+    c->polygons->lastcol = 0;
+    c->uvs->lastcol = 0;
+    obj_parser(c->polygons, c->uvs, file);
+    c->stamp = mesh_stamp(c);
+    meshes.misses++;
+  } else
+    meshes.hits++;
+
+  c->run = meshes.run;
+  append_columns(polygons, c->polygons);
+  append_columns(uvs, c->uvs);
+}
+
+void
+sphere_polygons(struct matrix* polygons,
+                double cx,
+                double cy,
+                double cz,
+                double r,
+                int step)
+{
+  /*
+  Add the polygons of a sphere, like add_sphere, tessellating it only the
+  first time.
+
+  @param: struct matrix* polygons
+  @param: double cx
+  @param: double cy
+  @param: double cz
+  @param: double r
+  @param: int step
+
+  @return: void
+  */
+  double params[CACHED_PARAMS] = { cx, cy, cz, r, 0, step };
+  struct cached_mesh* c = find_mesh(CACHED_SPHERE, NULL, params);
+
+  if (!c) {
+    c = new_mesh(CACHED_SPHERE, NULL, params);
+    add_sphere(c->polygons, cx, cy, cz, r, step);
+    meshes.misses++;
+  } else
+    meshes.hits++;
+
+  c->run = meshes.run;
+  append_columns(polygons, c->polygons);
+}
+
+void
+torus_polygons(struct matrix* polygons,
+               double cx,
+               double cy,
+               double cz,
+               double r0,
+               double r1,
+               int step)
+{
+  /*
+  Add the polygons of a torus, like add_torus, tessellating it only the
+  first time.
+
+  @param: struct matrix* polygons
+  @param: double cx
+  @param: double cy
+  @param: double cz
+  @param: double r0
+  @param: double r1
+  @param: int step
+
+  @return: void
+  */
+  double params[CACHED_PARAMS] = { cx, cy, cz, r0, r1, step };
+  struct cached_mesh* c = find_mesh(CACHED_TORUS, NULL, params);
+
+  if (!c) {
+    c = new_mesh(CACHED_TORUS, NULL, params);
+    add_torus(c->polygons, cx, cy, cz, r0, r1, step);
+    meshes.misses++;
+  } else
+    meshes.hits++;
+
+  c->run = meshes.run;
+  append_columns(polygons, c->polygons);
+}
+
+void
+mesh_sweep(int runs)
+{
+  /*
+  Drop the entries that have not been drawn in the last runs runs, the one
+  that just finished included, and start the next run.
+
+  @param: int runs
+
+  @return: void
+  */
+  int i, kept = 0;
+
+  for (i = 0; i < meshes.count; i++) {
+    if (meshes.run - meshes.list[i].run < runs)
+      meshes.list[kept++] = meshes.list[i];
+    else
+      drop_mesh(&meshes.list[i]);
+  }
+  meshes.count = kept;
+  index_meshes();
+  meshes.run++;
+}
+
+void
+free_meshes()
+{
+  /*
+  Release every entry.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  for (i = 0; i < meshes.count; i++)
+    drop_mesh(&meshes.list[i]);
+  free(meshes.list);
+  free(meshes.slots);
+  memset(&meshes, 0, sizeof(meshes));
+}
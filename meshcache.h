@@ -0,0 +1,61 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "matrix.h"
+
+#define CACHED_OBJ 0
+#define CACHED_SPHERE 1
+#define CACHED_TORUS 2
+#define CACHED_PARAMS 6
+
+struct cached_mesh
+{
+  int kind;
+  /* the OBJ file, and the modification times and sizes of it and of the
+     files it reads (see mesh_files) when it was read */
+  char* file;
+  char** files;
+  int file_count;
+  unsigned long long stamp;
+  double params[CACHED_PARAMS];
+  /* the last run that drew it, and the last run that checked its files */
+  int run;
+  int checked;
+  struct matrix* polygons;
+  /* NULL for spheres and tori */
+  struct matrix* uvs;
+};
+
+struct mesh_cache
+{
+  struct cached_mesh* list;
+  int count, capacity;
+  /* open addressing hash of the entries, each slot 1 + an index into list
+     or 0 when empty */
+  int* slots;
+  int slot_count;
+  int run;
+  int hits, misses;
+};
+
+extern struct mesh_cache meshes;
+
+long long
+file_stamp(char*);
+
+void
+mesh_polygons(struct matrix*, struct matrix*, char*);
+
+void
+sphere_polygons(struct matrix*, double, double, double, double, int);
+
+void
+torus_polygons(struct matrix*, double, double, double, double, double, int);
+
+void
+mesh_sweep(int);
+
+void
+free_meshes();
+
+#endif
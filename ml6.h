@@ -1,11 +1,15 @@
 #ifndef ML6_H
 #define ML6_H
 
+#include <float.h>
+#include <limits.h>
+
 #define XRES 500
 #define YRES 500
 #define MAX_COLOR 255
 #define DEFAULT_COLOR 0
 #define MAX_LIGHTS 10
+#define CHECKSUM_SEED 14695981039346656037ULL
 
 struct point_t
 {
@@ -18,5 +22,59 @@ typedef struct point_t color;
 
 typedef struct point_t screen[XRES][YRES];
 
-typedef double zbuffer[XRES][YRES];
+/*
+Depth buffer format, chosen at compile time with make DEPTH=...
+  F64  double holding z, the original format
+  F32  float holding z
+  F32R float holding (DEPTH_RANGE - z) / (2 * DEPTH_RANGE), so it shrinks
+       towards the viewer and float's densest precision is in front
+  U32  z mapped from [-DEPTH_RANGE, DEPTH_RANGE] onto 0..2^32-1
+  U24  the same onto 0..2^24-1
+Larger z is closer to the viewer. DEPTH_TEST(old, new) is true when new is
+at least as close as old, DEPTH_ENCODE turns z into a stored value.
+*/
+#define DEPTH_F64 0
+#define DEPTH_F32 1
+#define DEPTH_F32R 2
+#define DEPTH_U32 3
+#define DEPTH_U24 4
+
+#ifndef DEPTH_FORMAT
+#define DEPTH_FORMAT DEPTH_F64
+#endif
+
+#define DEPTH_RANGE 2048.0
+#define DEPTH_CLAMP(z)                                                         \
+  ((z) < -DEPTH_RANGE ? -DEPTH_RANGE : (z) > DEPTH_RANGE ? DEPTH_RANGE : (z))
+
+#if DEPTH_FORMAT == DEPTH_F64
+typedef double depth_t;
+#define DEPTH_CLEAR ((double)LONG_MIN)
+#define DEPTH_ENCODE(z) (z)
+#define DEPTH_TEST(old, new) ((old) <= (new))
+#elif DEPTH_FORMAT == DEPTH_F32
+typedef float depth_t;
+#define DEPTH_CLEAR (-FLT_MAX)
+#define DEPTH_ENCODE(z) ((float)(z))
+#define DEPTH_TEST(old, new) ((old) <= (new))
+#elif DEPTH_FORMAT == DEPTH_F32R
+typedef float depth_t;
+#define DEPTH_CLEAR 1.0f
+#define DEPTH_ENCODE(z)                                                        \
+  ((float)((DEPTH_RANGE - DEPTH_CLAMP(z)) / (2 * DEPTH_RANGE)))
+#define DEPTH_TEST(old, new) ((new) <= (old))
+#elif DEPTH_FORMAT == DEPTH_U32 || DEPTH_FORMAT == DEPTH_U24
+typedef unsigned int depth_t;
+#define DEPTH_MAX (DEPTH_FORMAT == DEPTH_U32 ? 4294967295.0 : 16777215.0)
+#define DEPTH_CLEAR 0u
+#define DEPTH_ENCODE(z)                                                        \
+  ((unsigned int)((DEPTH_CLAMP(z) + DEPTH_RANGE) / (2 * DEPTH_RANGE) *         \
+                    DEPTH_MAX +                                                \
+                  0.5))
+#define DEPTH_TEST(old, new) ((old) <= (new))
+#else
+#error "unknown DEPTH_FORMAT"
+#endif
+
+typedef depth_t zbuffer[XRES][YRES];
 #endif
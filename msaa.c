@@ -0,0 +1,208 @@
+/*
+Multisample anti-aliasing for polygons. Each pixel keeps 4 or 8 samples,
+each with its own color and depth. A triangle is rasterized with edge
+functions evaluated at the sample positions, giving a coverage mask per
+pixel; the triangle's color is worked out once (lighting is per triangle)
+and written to every covered sample that passes its depth test.
+msaa_resolve averages the samples into the screen before it is saved.
+Lines are not multisampled: they are drawn into the screen and zbuffer as
+usual and kept by the resolve wherever they are in front of the samples.
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "matrix.h"
+#include "ml6.h"
+#include "msaa.h"
+#include "profile.h"
+
+struct msaa_buffer msaa;
+
+/* sample offsets from the pixel center in 1/16 pixel, the usual rotated
+   grid patterns */
+double pattern4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+double pattern8[8][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 },  { -3, -5 },
+                          { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+
+void
+msaa_start(int samples)
+{
+  /*
+  Allocate the sample buffers for 4 or 8 samples per pixel.
+
+  @param: int samples
+
+  @return: void
+  */
+  int k;
+
+  msaa.samples = samples;
+  for (k = 0; k < samples; k++) {
+    msaa.dx[k] = (samples == 4 ? pattern4[k][0] : pattern8[k][0]) / 16;
+    msaa.dy[k] = (samples == 4 ? pattern4[k][1] : pattern8[k][1]) / 16;
+  }
+  msaa.colors = (color*)malloc(sizeof(color) * XRES * YRES * samples);
+  msaa.depths = (depth_t*)malloc(sizeof(depth_t) * XRES * YRES * samples);
+}
+
+void
+msaa_clear()
+{
+  /*
+  Reset every sample to the default color and the farthest depth.
+
+  @param: No parameters
+
+  @return: void
+  */
+  long i;
+  long n = (long)XRES * YRES * msaa.samples;
+
+  for (i = 0; i < n; i++) {
+    msaa.colors[i].red = DEFAULT_COLOR;
+    msaa.colors[i].green = DEFAULT_COLOR;
+    msaa.colors[i].blue = DEFAULT_COLOR;
+    msaa.depths[i] = DEPTH_CLEAR;
+  }
+}
+
+void
+msaa_triangle(struct matrix* points, int i, color c)
+{
+  /*
+  Rasterize triangle i of points into the sample buffers with color c.
+
+  @param: struct matrix* points
+  @param: int i
+  @param: color c
+
+  @return: void
+  */
+  double x[3], y[3], z[3];
+  double a[3], b[3], e[3], area;
+  double sa[3][MSAA_MAX_SAMPLES], zs[MSAA_MAX_SAMPLES];
+  double zx, zy, zo, px, py;
+  depth_t depth;
+  int xmin, xmax, ymin, ymax, col, row;
+  int j, k, u, v;
+  long base;
+
+  for (j = 0; j < 3; j++) {
+    x[j] = points->m[0][i + j];
+    y[j] = points->m[1][i + j];
+    z[j] = points->m[2][i + j];
+  }
+
+  area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0)
+    return;
+
+  /* edge j is opposite vertex j, scaled to be positive inside */
+  for (j = 0; j < 3; j++) {
+    u = (j + 1) % 3;
+    v = (j + 2) % 3;
+    a[j] = (y[u] - y[v]) / area;
+    b[j] = (x[v] - x[u]) / area;
+    e[j] = ((y[v] - y[u]) * x[u] - (x[v] - x[u]) * y[u]) / area;
+    for (k = 0; k < msaa.samples; k++)
+      sa[j][k] = a[j] * msaa.dx[k] + b[j] * msaa.dy[k];
+  }
+
+  /* z over the plane of the triangle, from the barycentric weights */
+  zx = a[0] * z[0] + a[1] * z[1] + a[2] * z[2];
+  zy = b[0] * z[0] + b[1] * z[1] + b[2] * z[2];
+  zo = e[0] * z[0] + e[1] * z[1] + e[2] * z[2];
+  for (k = 0; k < msaa.samples; k++)
+    zs[k] = zx * msaa.dx[k] + zy * msaa.dy[k];
+
+  xmin = (int)floor(fmin(x[0], fmin(x[1], x[2])));
+  xmax = (int)floor(fmax(x[0], fmax(x[1], x[2])));
+  ymin = (int)floor(fmin(y[0], fmin(y[1], y[2])));
+  ymax = (int)floor(fmax(y[0], fmax(y[1], y[2])));
+  xmin = xmin < 0 ? 0 : xmin;
+  ymin = ymin < 0 ? 0 : ymin;
+  xmax = xmax >= XRES ? XRES - 1 : xmax;
+  ymax = ymax >= YRES ? YRES - 1 : ymax;
+
+  for (col = xmin; col <= xmax; col++) {
+    px = col + 0.5;
+    for (row = ymin; row <= ymax; row++) {
+      py = row + 0.5;
+      base = ((long)col * YRES + (YRES - 1 - row)) * msaa.samples;
+      for (k = 0; k < msaa.samples; k++) {
+        if (a[0] * px + b[0] * py + e[0] + sa[0][k] < 0 ||
+            a[1] * px + b[1] * py + e[1] + sa[1][k] < 0 ||
+            a[2] * px + b[2] * py + e[2] + sa[2][k] < 0)
+          continue;
+
+        depth = DEPTH_ENCODE(
+          (int)((zx * px + zy * py + zo + zs[k]) * 1000) / 1000.0);
+        prof.depth_tests++;
+        if (DEPTH_TEST(msaa.depths[base + k], depth)) {
+          msaa.depths[base + k] = depth;
+          msaa.colors[base + k] = c;
+          prof.pixels++;
+        }
+      }
+    }
+  }
+}
+
+void
+msaa_resolve(screen s, zbuffer zb)
+{
+  /*
+  Average the samples of every pixel into s. Pixels where something was
+  drawn into s directly (lines) in front of all of the samples keep it.
+
+  @param: screen s
+  @param: zbuffer zb
+
+  @return: void
+  */
+  int x, y, k;
+  int red, green, blue;
+  int n = msaa.samples;
+  depth_t front;
+  long base;
+
+  for (x = 0; x < XRES; x++) {
+    for (y = 0; y < YRES; y++) {
+      base = ((long)x * YRES + y) * n;
+      red = green = blue = 0;
+      front = DEPTH_CLEAR;
+      for (k = 0; k < n; k++) {
+        red += msaa.colors[base + k].red;
+        green += msaa.colors[base + k].green;
+        blue += msaa.colors[base + k].blue;
+        if (DEPTH_TEST(front, msaa.depths[base + k]))
+          front = msaa.depths[base + k];
+      }
+      if (zb[x][y] != DEPTH_CLEAR && DEPTH_TEST(front, zb[x][y]))
+        continue;
+      s[x][y].red = (red + n / 2) / n;
+      s[x][y].green = (green + n / 2) / n;
+      s[x][y].blue = (blue + n / 2) / n;
+    }
+  }
+}
+
+void
+msaa_stop()
+{
+  /*
+  Free the sample buffers.
+
+  @param: No parameters
+
+  @return: void
+  */
+  free(msaa.colors);
+  free(msaa.depths);
+  msaa.colors = NULL;
+  msaa.depths = NULL;
+  msaa.samples = 0;
+}
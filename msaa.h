@@ -0,0 +1,34 @@
+#ifndef MSAA_H
+#define MSAA_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+#define MSAA_MAX_SAMPLES 8
+
+struct msaa_buffer
+{
+  int samples;
+  double dx[MSAA_MAX_SAMPLES], dy[MSAA_MAX_SAMPLES];
+  color* colors;
+  depth_t* depths;
+};
+
+extern struct msaa_buffer msaa;
+
+void
+msaa_start(int);
+
+void
+msaa_clear();
+
+void
+msaa_triangle(struct matrix*, int, color);
+
+void
+msaa_resolve(screen, zbuffer);
+
+void
+msaa_stop();
+
+#endif
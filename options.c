@@ -0,0 +1,262 @@
+/*
+Command line handling for mdl. Every flag ends up in the global opts so the
+rest of the interpreter can check it without passing it around.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fixed.h"
+#include "options.h"
+#include "preview.h"
+#include "stream.h"
+
+struct options opts;
+
+void
+usage(char* program)
+{
+  /*
+  Print the accepted arguments and exit.
+
+  @param: char* program
+
+  @return: void
+  */
+  printf("Usage: %s [options] script.mdl [script.mdl ...]\n", program);
+  printf("       %s --server SOCKET [options]\n", program);
+  printf("  --profile             print time spent per command and render "
+         "counters\n");
+  printf("  --profile-json FILE   also write the profile as JSON to FILE\n");
+  printf("  --headless            render without saving or displaying "
+         "anything\n");
+  printf("  --bench               headless run that prints timing and a "
+         "framebuffer checksum\n");
+  printf("  --perf                hardware counters per render stage, per "
+         "frame and in total\n");
+  printf("  --stream FILE         write every frame to FILE (- for stdout, "
+         "or a FIFO) instead of images\n");
+  printf("  --stream-format FMT   y4m (default) or rgb24\n");
+  printf("  --format FMT          png (default), ppm or pam for the frames "
+         "in anim/\n");
+  printf("  --frames START:END    only render frames START to END "
+         "(0-based, inclusive, END may be left out)\n");
+  printf("  --shard K/N           only render the K-th of N equal blocks of "
+         "frames (0-based)\n");
+  printf("  --assemble            make the animation from frames already in "
+         "anim/ without rendering\n");
+  printf("  --raster MODE         scanline (default) or fixed, for 24.8 "
+         "fixed point edges and exact depth\n");
+  printf("  --msaa N              anti-alias polygons with N (4 or 8) "
+         "samples per pixel\n");
+  printf("  --shadows             shadow polygons with a shadow map per "
+         "light\n");
+  printf("  --force               render every frame even if its image in "
+         "anim/ is up to date\n");
+  printf("  --watch               keep running, and run the script again "
+         "whenever it or a file it reads changes\n");
+  printf("  --jobs N              render the scripts given in N processes "
+         "that share the meshes they load\n");
+  printf("  --server SOCKET       render scripts sent to the Unix socket "
+         "SOCKET, keeping meshes loaded\n");
+  printf("  --preview[=NAME]      publish frames to a shared memory ring "
+         "for viewer/mdlview (default %s)\n",
+         PREVIEW_DEFAULT);
+  exit(1);
+}
+
+int
+read_options(int argc, char** argv)
+{
+  /*
+  Fill in opts from argv, starting from the defaults. Returns 0 instead of
+  exiting if they are not valid, since the render server reads the options
+  of every job this way.
+
+  @param: int argc
+  @param: char** argv
+
+  @return: int
+  */
+  int c;
+  char extra;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.first = 0;
+  opts.last = -1;
+  opts.shard = 0;
+  opts.shards = 1;
+  opts.jobs = 1;
+  struct option long_options[] = { { "profile", no_argument, 0, 'p' },
+                                   { "profile-json", required_argument, 0, 'j' },
+                                   { "headless", no_argument, 0, 'H' },
+                                   { "bench", no_argument, 0, 'b' },
+                                   { "perf", no_argument, 0, 'P' },
+                                   { "stream", required_argument, 0, 's' },
+                                   { "stream-format",
+                                     required_argument,
+                                     0,
+                                     'f' },
+                                   { "preview", optional_argument, 0, 'v' },
+                                   { "format", required_argument, 0, 'F' },
+                                   { "frames", required_argument, 0, 'r' },
+                                   { "shard", required_argument, 0, 'k' },
+                                   { "assemble", no_argument, 0, 'a' },
+                                   { "force", no_argument, 0, 'c' },
+                                   { "msaa", required_argument, 0, 'm' },
+                                   { "raster", required_argument, 0, 'R' },
+                                   { "shadows", no_argument, 0, 'S' },
+                                   { "watch", no_argument, 0, 'w' },
+                                   { "server", required_argument, 0, 'D' },
+                                   { "jobs", required_argument, 0, 'J' },
+                                   { "help", no_argument, 0, 'h' },
+                                   { 0, 0, 0, 0 } };
+
+  optind = 0;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'p':
+        opts.profile = 1;
+        break;
+      case 'j':
+        opts.profile = 1;
+        opts.profile_json = optarg;
+        break;
+      case 'H':
+        opts.headless = 1;
+        break;
+      case 'b':
+        opts.headless = 1;
+        opts.bench = 1;
+        break;
+      case 'P':
+        opts.perf = 1;
+        break;
+      case 's':
+        opts.stream = optarg;
+        break;
+      case 'f':
+        if (strcmp(optarg, "y4m") == 0)
+          opts.stream_format = STREAM_Y4M;
+        else if (strcmp(optarg, "rgb24") == 0)
+          opts.stream_format = STREAM_RGB24;
+        else
+          return 0;
+        break;
+      case 'F':
+        if (strcmp(optarg, "png") && strcmp(optarg, "ppm") &&
+            strcmp(optarg, "pam"))
+          return 0;
+        opts.format = optarg;
+        break;
+      case 'r':
+        if (sscanf(optarg, "%d:%d%c", &opts.first, &opts.last, &extra) != 2 &&
+            !(sscanf(optarg, "%d:%c", &opts.first, &extra) == 1 &&
+              optarg[strlen(optarg) - 1] == ':'))
+          return 0;
+        if (opts.first < 0 || (opts.last >= 0 && opts.last < opts.first))
+          return 0;
+        break;
+      case 'k':
+        if (sscanf(optarg, "%d/%d%c", &opts.shard, &opts.shards, &extra) != 2 ||
+            opts.shards < 1 || opts.shard < 0 || opts.shard >= opts.shards)
+          return 0;
+        break;
+      case 'a':
+        opts.assemble = 1;
+        break;
+      case 'c':
+        opts.force = 1;
+        break;
+      case 'R':
+        if (strcmp(optarg, "scanline") == 0)
+          opts.raster = RASTER_SCANLINE;
+        else if (strcmp(optarg, "fixed") == 0)
+          opts.raster = RASTER_FIXED;
+        else
+          return 0;
+        break;
+      case 'm':
+        opts.msaa = atoi(optarg);
+        if (opts.msaa != 4 && opts.msaa != 8)
+          return 0;
+        break;
+      case 'S':
+        opts.shadows = 1;
+        break;
+      case 'w':
+        opts.watch = 1;
+        break;
+      case 'D':
+        opts.server = optarg;
+        break;
+      case 'J':
+        opts.jobs = atoi(optarg);
+        if (opts.jobs < 1)
+          return 0;
+        break;
+      case 'v':
+        opts.preview = optarg ? optarg : PREVIEW_DEFAULT;
+        break;
+      default:
+        return 0;
+    }
+  }
+
+  if (!opts.format)
+    opts.format = "png";
+
+  if (opts.shadows && opts.msaa) {
+    printf("Error: --shadows and --msaa cannot be used together\n");
+    return 0;
+  }
+
+  if (opts.watch && opts.assemble) {
+    printf("Error: --watch and --assemble cannot be used together\n");
+    return 0;
+  }
+
+  if (opts.server &&
+      (opts.watch || opts.assemble || opts.stream || opts.preview)) {
+    printf("Error: --server cannot be used with --watch, --assemble, "
+           "--stream or --preview\n");
+    return 0;
+  }
+
+  /* the server reads its scripts from its clients */
+  if (opts.server && optind == argc)
+    return 1;
+  if (optind == argc)
+    return 0;
+
+  opts.scripts = argv + optind;
+  opts.script_count = argc - optind;
+  opts.script = opts.scripts[0];
+
+  if (opts.script_count > 1 && (opts.watch || opts.server)) {
+    printf("Error: --watch and --server take a single script\n");
+    return 0;
+  }
+  if (opts.jobs > 1 && (opts.stream || opts.preview)) {
+    printf("Error: --jobs cannot be used with --stream or --preview\n");
+    return 0;
+  }
+  return 1;
+}
+
+void
+parse_options(int argc, char** argv)
+{
+  /*
+  Fill in opts from the command line, or print the usage and exit.
+
+  @param: int argc
+  @param: char** argv
+
+  @return: void
+  */
+  if (!read_options(argc, argv))
+    usage(argv[0]);
+}
@@ -0,0 +1,41 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+struct options
+{
+  char* script;
+  char** scripts;
+  int script_count;
+  int jobs;
+  int profile;
+  char* profile_json;
+  int headless;
+  int bench;
+  int perf;
+  char* stream;
+  int stream_format;
+  char* preview;
+  char* format;
+  int first, last;
+  int shard, shards;
+  int assemble;
+  int force;
+  int msaa;
+  int raster;
+  int shadows;
+  int watch;
+  char* server;
+};
+
+extern struct options opts;
+
+int
+read_options(int, char**);
+
+void
+parse_options(int, char**);
+
+void
+usage(char*);
+
+#endif
@@ -4,9 +4,10 @@
 #include "matrix.h"
 #include "symtab.h"
 
-#define MAX_COMMANDS 512
+#define OP_CHUNK 64
 
 extern int lastop;
+extern int maxop;
 
 #define Ka 0
 #define Kd 1
@@ -88,7 +89,7 @@ struct command
     struct
     {
       SYMTAB* constants;
-      char name[255];
+      char* name;
       SYMTAB* cs;
     } mesh;
 
@@ -167,18 +168,24 @@ struct command
   } op;
 };
 
-extern struct command op[MAX_COMMANDS];
+extern struct command* op;
 
 int num_frames;
 
 char name[128];
 
-struct vary_node
+struct knob_table
 {
-
-  char name[128];
-  double value;
-  struct vary_node* next;
+  /* every knob the script uses, in the order they first appear */
+  int count;
+  SYMTAB** knobs;
+  /* the frames there are rows for, start to end of this run */
+  int start, end;
+  /* count values for each frame, frame f's from
+     values + (f - start) * count */
+  double* values;
+  /* knobs that vary or tween change, printed as each frame starts */
+  char* animated;
 };
 
 void
@@ -187,16 +194,34 @@ print_knobs();
 void
 process_knobs();
 
-void
+int
 first_pass();
 
-struct vary_node**
-second_pass();
+struct knob_table*
+second_pass(int, int);
+
+void
+free_knobs(struct knob_table*);
+
+int
+frame_range(int*, int*);
+
+void
+frame_file(char*, int);
+
+int
+assemble();
 
 void
 print_pcode();
 
 void
+grow_ops();
+
+void
+reset_parser();
+
+int
 script();
 
 #endif
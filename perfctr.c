@@ -0,0 +1,360 @@
+/*
+Hardware performance counters for each stage of rendering, using Linux
+perf_event_open. The counters are opened as one group and read whenever the
+interpreter moves from one stage to another, so the difference since the
+last read is charged to the stage that was running. Stages change once per
+command and draw call, not per triangle, since every read is a system call
+that would show up in the counts.
+
+Counters only follow the thread that opens them. The writer thread opens a
+group of its own (perf_thread_open), and everything it counts is charged to
+encode when the interpreter's counters are reported. The worker threads of
+shading raytrace are not counted; only the share of the tiles traced on the
+interpreter's thread is.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "options.h"
+#include "perfctr.h"
+
+struct perf_counters perf;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+char* stage_names[STAGES] = { "other",     "parse",    "knobs",
+                              "geometry",  "transform", "lighting",
+                              "raster",    "encode" };
+
+#ifdef __linux__
+int
+open_counter(int type, unsigned long long config, int group)
+{
+  /*
+  Open a single counter for the calling thread in the given group, or as
+  the leader when group is -1.
+
+  @param: int type
+  @param: unsigned long long config
+  @param: int group
+
+  @return: int
+  */
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static int
+open_group(int* fds)
+{
+  /*
+  Open every counter in one group for the calling thread into fds, the
+  leader first, and start them. Returns 0, with nothing left open, if they
+  are not all available.
+
+  @param: int* fds
+
+  @return: int
+  */
+  unsigned long long config[COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES,
+                                          PERF_COUNT_HW_INSTRUCTIONS,
+                                          PERF_COUNT_HW_CACHE_MISSES,
+                                          PERF_COUNT_HW_BRANCH_MISSES };
+  int i, j;
+
+  for (i = 0; i < COUNTERS; i++) {
+    fds[i] =
+      open_counter(PERF_TYPE_HARDWARE, config[i], i == 0 ? -1 : fds[0]);
+    if (fds[i] < 0) {
+      for (j = 0; j < i; j++)
+        close(fds[j]);
+      return 0;
+    }
+  }
+
+  ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return 1;
+}
+
+static void
+close_group(int* fds)
+{
+  /*
+  Close a group opened by open_group.
+
+  @param: int* fds
+
+  @return: void
+  */
+  int i;
+
+  for (i = COUNTERS - 1; i >= 0; i--)
+    close(fds[i]);
+}
+#endif
+
+static void
+charge(int fd, unsigned long long* last, int stage)
+{
+  /*
+  Read the group led by fd and charge what it counted since last to stage.
+
+  @param: int fd
+  @param: unsigned long long* last
+  @param: int stage
+
+  @return: void
+  */
+  unsigned long long values[COUNTERS + 1];
+  unsigned long long delta;
+  int i;
+
+  if (read(fd, values, sizeof(values)) != sizeof(values))
+    return;
+  for (i = 0; i < COUNTERS; i++) {
+    delta = values[i + 1] - last[i];
+    perf.frame[stage][i] += delta;
+    perf.total[stage][i] += delta;
+    last[i] = values[i + 1];
+  }
+}
+
+void
+perf_open()
+{
+  /*
+  Open the counter group if --perf was given. When the counters are not
+  available, a warning is printed and the run goes on without them.
+
+  @param: No parameters
+
+  @return: void
+  */
+  memset(&perf, 0, sizeof(perf));
+  perf.fd = -1;
+
+  if (!opts.perf)
+    return;
+
+#ifdef __linux__
+  if (!open_group(perf.fds)) {
+    printf("Warning: hardware counters are not available, running without "
+           "--perf\n");
+    return;
+  }
+  perf.fd = perf.fds[0];
+  perf.enabled = 1;
+#else
+  printf("Warning: --perf needs Linux perf_event_open\n");
+#endif
+}
+
+void
+perf_thread_open()
+{
+  /*
+  Start counting the calling thread, the writer, as encode.
+
+  @param: No parameters
+
+  @return: void
+  */
+  if (!perf.enabled)
+    return;
+
+#ifdef __linux__
+  pthread_mutex_lock(&lock);
+  memset(perf.writer_last, 0, sizeof(perf.writer_last));
+  perf.writer_open = open_group(perf.writer_fds);
+  pthread_mutex_unlock(&lock);
+#endif
+}
+
+void
+perf_thread_close()
+{
+  /*
+  Charge what is left of the writer thread's counts to encode and stop
+  counting it. Called by the writer thread as it ends.
+
+  @param: No parameters
+
+  @return: void
+  */
+#ifdef __linux__
+  pthread_mutex_lock(&lock);
+  if (perf.writer_open) {
+    charge(perf.writer_fds[0], perf.writer_last, STAGE_ENCODE);
+    close_group(perf.writer_fds);
+    perf.writer_open = 0;
+  }
+  pthread_mutex_unlock(&lock);
+#endif
+}
+
+static void
+charge_writer()
+{
+  /*
+  Charge what the writer thread has counted so far to encode.
+
+  @param: No parameters
+
+  @return: void
+  */
+  pthread_mutex_lock(&lock);
+  if (perf.writer_open)
+    charge(perf.writer_fds[0], perf.writer_last, STAGE_ENCODE);
+  pthread_mutex_unlock(&lock);
+}
+
+int
+perf_stage(int stage)
+{
+  /*
+  Charge everything counted since the last call to the current stage, then
+  make stage current. Returns the previous stage so callers can restore it.
+
+  @param: int stage
+
+  @return: int
+  */
+  int previous = perf.stage;
+
+  if (!perf.enabled)
+    return previous;
+
+  charge(perf.fd, perf.last, previous);
+  perf.stage = stage;
+  return previous;
+}
+
+void
+print_counters(char* label, char* stage, unsigned long long* c)
+{
+  /*
+  Print one row of counters.
+
+  @param: char* label
+  @param: char* stage
+  @param: unsigned long long* c
+
+  @return: void
+  */
+  printf("%-8s %-10s %14llu %14llu %6.2f %12llu %12llu\n",
+         label,
+         stage,
+         c[CYCLES],
+         c[INSTRUCTIONS],
+         c[CYCLES] ? (double)c[INSTRUCTIONS] / c[CYCLES] : 0,
+         c[LLC_MISSES],
+         c[BRANCH_MISSES]);
+}
+
+void
+perf_frame(int f)
+{
+  /*
+  Print the counters for frame f, then start counting the next frame.
+
+  @param: int f
+
+  @return: void
+  */
+  int i;
+  char label[16];
+  static int header = 0;
+
+  if (!perf.enabled)
+    return;
+
+  if (!header) {
+    printf("%-8s %-10s %14s %14s %6s %12s %12s\n",
+           "",
+           "stage",
+           "cycles",
+           "instructions",
+           "IPC",
+           "LLC misses",
+           "br misses");
+    header = 1;
+  }
+
+  perf_stage(perf.stage);
+  charge_writer();
+  sprintf(label, "frame %d", f);
+  for (i = 0; i < STAGES; i++)
+    if (perf.frame[i][CYCLES])
+      print_counters(label, stage_names[i], perf.frame[i]);
+
+  memset(perf.frame, 0, sizeof(perf.frame));
+}
+
+void
+perf_report()
+{
+  /*
+  Print the counters for each stage over the whole run.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  if (!perf.enabled)
+    return;
+
+  perf_stage(perf.stage);
+  charge_writer();
+  printf("\n%-8s %-10s %14s %14s %6s %12s %12s\n",
+         "",
+         "stage",
+         "cycles",
+         "instructions",
+         "IPC",
+         "LLC misses",
+         "br misses");
+  for (i = 0; i < STAGES; i++)
+    if (perf.total[i][CYCLES])
+      print_counters("total", stage_names[i], perf.total[i]);
+}
+
+void
+perf_close()
+{
+  /*
+  Close the counters.
+
+  @param: No parameters
+
+  @return: void
+  */
+#ifdef __linux__
+  if (perf.enabled)
+    close_group(perf.fds);
+#endif
+  perf.enabled = 0;
+  perf.fd = -1;
+}
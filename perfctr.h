@@ -0,0 +1,59 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#define STAGE_OTHER 0
+#define STAGE_PARSE 1
+#define STAGE_KNOBS 2
+#define STAGE_GEOMETRY 3
+#define STAGE_TRANSFORM 4
+#define STAGE_LIGHTING 5
+#define STAGE_RASTER 6
+#define STAGE_ENCODE 7
+#define STAGES 8
+
+#define CYCLES 0
+#define INSTRUCTIONS 1
+#define LLC_MISSES 2
+#define BRANCH_MISSES 3
+#define COUNTERS 4
+
+struct perf_counters
+{
+  int enabled;
+  /* the group of the interpreter's thread, fd being its leader */
+  int fd;
+  int fds[COUNTERS];
+  /* the group of the writer thread, while it runs */
+  int writer_fds[COUNTERS];
+  int writer_open;
+  unsigned long long writer_last[COUNTERS];
+  int stage;
+  unsigned long long last[COUNTERS];
+  unsigned long long frame[STAGES][COUNTERS];
+  unsigned long long total[STAGES][COUNTERS];
+};
+
+extern struct perf_counters perf;
+
+void
+perf_open();
+
+int
+perf_stage(int);
+
+void
+perf_thread_open();
+
+void
+perf_thread_close();
+
+void
+perf_frame(int);
+
+void
+perf_report();
+
+void
+perf_close();
+
+#endif
@@ -0,0 +1,114 @@
+/*
+Preview through a POSIX shared memory ring. Each finished frame is packed
+into the next of PREVIEW_SLOTS slots of a shared memory object, guarded by
+a per-slot sequence number, so a viewer in another process can map the ring
+and read frames in place. The renderer never waits for a viewer.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "ml6.h"
+#include "preview.h"
+
+struct preview_ring* ring = NULL;
+char* ring_name;
+
+void
+preview_open(char* name)
+{
+  /*
+  Create the shared memory object name, sized for the ring, and map it.
+
+  @param: char* name
+
+  @return: void
+  */
+  int fd;
+
+  fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+  if (fd < 0 || ftruncate(fd, sizeof(struct preview_ring)) < 0) {
+    printf("Error: could not create preview ring %s: %s\n",
+           name,
+           strerror(errno));
+    exit(1);
+  }
+
+  ring = (struct preview_ring*)mmap(NULL,
+                                    sizeof(struct preview_ring),
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED,
+                                    fd,
+                                    0);
+  close(fd);
+  if (ring == MAP_FAILED) {
+    printf("Error: could not map preview ring %s: %s\n", name, strerror(errno));
+    exit(1);
+  }
+
+  memset(ring, 0, sizeof(struct preview_ring));
+  ring->width = XRES;
+  ring->height = YRES;
+  ring->slots = PREVIEW_SLOTS;
+  ring->latest = -1;
+  __atomic_store_n(&ring->magic, PREVIEW_MAGIC, __ATOMIC_RELEASE);
+  ring_name = name;
+  printf("Preview: publishing frames to shared memory %s\n", name);
+}
+
+void
+preview_publish(screen s, int frame)
+{
+  /*
+  Copy s into the next slot of the ring as rgb24 and mark it as the latest
+  frame.
+
+  @param: screen s
+  @param: int frame
+
+  @return: void
+  */
+  int i;
+  struct preview_slot* slot;
+
+  if (!ring)
+    return;
+
+  i = ring->published % PREVIEW_SLOTS;
+  slot = &ring->slot[i];
+
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  slot->frame = frame;
+  pack_rgb24(s, slot->rgb);
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&ring->latest, i, __ATOMIC_RELAXED);
+  __atomic_store_n(&ring->published, ring->published + 1, __ATOMIC_RELEASE);
+}
+
+void
+preview_close()
+{
+  /*
+  Tell viewers that no more frames are coming, then unmap and unlink the
+  ring. Viewers that have it mapped keep their view of the last frames.
+
+  @param: No parameters
+
+  @return: void
+  */
+  if (!ring)
+    return;
+
+  __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+  munmap(ring, sizeof(struct preview_ring));
+  shm_unlink(ring_name);
+  ring = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "ml6.h"
+
+#define PREVIEW_MAGIC 0x4d444c50
+#define PREVIEW_SLOTS 3
+#define PREVIEW_DEFAULT "/mdl-preview"
+
+/*
+Layout of the shared memory object. A slot's seq is odd while it is being
+written; a reader that sees the same even seq before and after reading a
+slot got a whole frame.
+*/
+struct preview_slot
+{
+  unsigned long long seq;
+  int frame;
+  unsigned char rgb[XRES * YRES * 3];
+};
+
+struct preview_ring
+{
+  unsigned int magic;
+  int width, height, slots;
+  unsigned long long published;
+  int latest;
+  int closed;
+  struct preview_slot slot[PREVIEW_SLOTS];
+};
+
+void
+preview_open(char*);
+
+void
+preview_publish(screen, int);
+
+void
+preview_close();
+
+#endif
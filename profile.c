@@ -0,0 +1,306 @@
+/*
+Collects where the time goes while a script renders. script() times every
+instruction it runs, and the drawing and saving code bumps the counters in
+prof as it works. The totals are printed as a table or written as JSON once
+the script finishes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compile.h"
+#include "options.h"
+#include "parser.h"
+#include "profile.h"
+#include "y.tab.h"
+
+struct profile prof;
+
+double
+profile_clock()
+{
+  /*
+  Return a monotonic timestamp in seconds.
+
+  @param: No parameters
+
+  @return: double
+  */
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+profile_start(int indices)
+{
+  /*
+  Reset the profile for a script with the given number of commands.
+
+  @param: int indices
+
+  @return: void
+  */
+  free(prof.index_time);
+  free(prof.index_count);
+  memset(&prof, 0, sizeof(prof));
+
+  prof.indices = indices;
+  prof.index_time = (double*)calloc(indices + 1, sizeof(double));
+  prof.index_count = (long*)calloc(indices + 1, sizeof(long));
+  prof.start = profile_clock();
+}
+
+void
+profile_op(int opcode, int index, double elapsed)
+{
+  /*
+  Charge elapsed seconds to an opcode and to the command at index.
+
+  @param: int opcode
+  @param: int index
+  @param: double elapsed
+
+  @return: void
+  */
+  if (opcode >= 0 && opcode < MAX_OPCODES) {
+    prof.opcode_time[opcode] += elapsed;
+    prof.opcode_count[opcode]++;
+  }
+  if (index >= 0 && index < prof.indices) {
+    prof.index_time[index] += elapsed;
+    prof.index_count[index]++;
+  }
+}
+
+void
+profile_stop(int frames)
+{
+  /*
+  Record the total wall time and the number of frames rendered.
+
+  @param: int frames
+
+  @return: void
+  */
+  prof.frames = frames;
+  prof.total = profile_clock() - prof.start;
+}
+
+char*
+opcode_name(int opcode)
+{
+  /*
+  Return a printable name for an opcode.
+
+  @param: int opcode
+
+  @return: char*
+  */
+  switch (opcode) {
+    case TRANSFORM:
+      return "transform";
+    case LIGHT:
+      return "light";
+    case SPHERE:
+      return "sphere";
+    case TORUS:
+      return "torus";
+    case BOX:
+      return "box";
+    case LINE:
+      return "line";
+    case MESH:
+      return "mesh";
+    case TEXTURE:
+      return "texture";
+    case SAVE_COORDS:
+      return "save_coords";
+    case MOVE:
+      return "move";
+    case SCALE:
+      return "scale";
+    case ROTATE:
+      return "rotate";
+    case PUSH:
+      return "push";
+    case POP:
+      return "pop";
+    case SAVE:
+      return "save";
+    case DISPLAY:
+      return "display";
+    case SHADING:
+      return "shading";
+  }
+  return "other";
+}
+
+int
+compare_index_time(const void* a, const void* b)
+{
+  /*
+  qsort comparator ordering command indices by descending time.
+
+  @param: const void* a
+  @param: const void* b
+
+  @return: int
+  */
+  double ta = prof.index_time[*(int*)a];
+  double tb = prof.index_time[*(int*)b];
+
+  return (ta < tb) - (ta > tb);
+}
+
+void
+print_profile()
+{
+  /*
+  Print the per opcode table, the slowest commands and the counters.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i, n;
+  double seconds = prof.total > 0 ? prof.total : 1;
+  int* order;
+
+  printf("\nProfile: %d frame(s) in %.3f ms (%.3f ms/frame)\n",
+         prof.frames,
+         prof.total * 1000,
+         prof.frames ? prof.total * 1000 / prof.frames : 0);
+
+  printf("\n%-10s %10s %12s %12s %7s\n",
+         "opcode",
+         "count",
+         "total ms",
+         "avg us",
+         "%");
+  for (i = 0; i < MAX_OPCODES; i++) {
+    if (!prof.opcode_count[i])
+      continue;
+    printf("%-10s %10ld %12.3f %12.3f %6.1f%%\n",
+           opcode_name(i),
+           prof.opcode_count[i],
+           prof.opcode_time[i] * 1000,
+           prof.opcode_time[i] * 1e6 / prof.opcode_count[i],
+           100 * prof.opcode_time[i] / seconds);
+  }
+
+  order = (int*)malloc(prof.indices * sizeof(int));
+  n = 0;
+  for (i = 0; i < prof.indices; i++)
+    if (prof.index_count[i])
+      order[n++] = i;
+  qsort(order, n, sizeof(int), compare_index_time);
+
+  printf("\n%-6s %-10s %10s %12s\n", "op", "opcode", "count", "total ms");
+  for (i = 0; i < n && i < PROFILE_TOP; i++)
+    printf("%-6d %-10s %10ld %12.3f\n",
+           order[i],
+           opcode_name(op[order[i]].opcode),
+           prof.index_count[order[i]],
+           prof.index_time[order[i]] * 1000);
+  free(order);
+
+  printf("\ntriangles submitted: %ld\n", prof.triangles);
+  printf("triangles culled:    %ld\n", prof.culled);
+  printf("pixels depth tested: %ld\n", prof.depth_tests);
+  printf("pixels written:      %ld\n", prof.pixels);
+  printf("bytes saved:         %ld\n", prof.bytes);
+}
+
+static void
+json_string(FILE* f, char* s)
+{
+  /*
+  Write s to f as a quoted JSON string, escaping quotes, backslashes and
+  control characters. NULL is written as "".
+
+  @param: FILE* f
+  @param: char* s
+
+  @return: void
+  */
+  unsigned char* p;
+
+  fputc('"', f);
+  for (p = (unsigned char*)(s ? s : ""); *p; p++) {
+    if (*p == '"' || *p == '\\')
+      fprintf(f, "\\%c", *p);
+    else if (*p < 0x20)
+      fprintf(f, "\\u%04x", *p);
+    else
+      fputc(*p, f);
+  }
+  fputc('"', f);
+}
+
+void
+save_profile_json(char* file)
+{
+  /*
+  Write the profile to file as a JSON object.
+
+  @param: char* file
+
+  @return: void
+  */
+  int i, first;
+  FILE* f;
+
+  f = fopen(file, "w");
+  if (f == NULL) {
+    printf("Error: could not write profile to %s\n", file);
+    return;
+  }
+
+  fprintf(f, "{\n  \"script\": ");
+  json_string(f, opts.script);
+  fprintf(f, ",\n");
+  fprintf(f, "  \"frames\": %d,\n", prof.frames);
+  fprintf(f, "  \"total_ms\": %.3f,\n", prof.total * 1000);
+  fprintf(f, "  \"triangles\": %ld,\n", prof.triangles);
+  fprintf(f, "  \"culled\": %ld,\n", prof.culled);
+  fprintf(f, "  \"depth_tests\": %ld,\n", prof.depth_tests);
+  fprintf(f, "  \"pixels\": %ld,\n", prof.pixels);
+  fprintf(f, "  \"bytes\": %ld,\n", prof.bytes);
+
+  fprintf(f, "  \"opcodes\": {");
+  first = 1;
+  for (i = 0; i < MAX_OPCODES; i++) {
+    if (!prof.opcode_count[i])
+      continue;
+    fprintf(f,
+            "%s\n    \"%s\": { \"count\": %ld, \"ms\": %.3f }",
+            first ? "" : ",",
+            opcode_name(i),
+            prof.opcode_count[i],
+            prof.opcode_time[i] * 1000);
+    first = 0;
+  }
+  fprintf(f, "\n  },\n");
+
+  fprintf(f, "  \"ops\": [");
+  first = 1;
+  for (i = 0; i < prof.indices; i++) {
+    if (!prof.index_count[i])
+      continue;
+    fprintf(f,
+            "%s\n    { \"op\": %d, \"opcode\": \"%s\", \"count\": %ld, "
+            "\"ms\": %.3f }",
+            first ? "" : ",",
+            i,
+            opcode_name(op[i].opcode),
+            prof.index_count[i],
+            prof.index_time[i] * 1000);
+    first = 0;
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+}
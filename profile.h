@@ -0,0 +1,46 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define MAX_OPCODES 512
+#define PROFILE_TOP 10
+
+struct profile
+{
+  double opcode_time[MAX_OPCODES];
+  long opcode_count[MAX_OPCODES];
+  double* index_time;
+  long* index_count;
+  int indices;
+
+  long triangles, culled;
+  long depth_tests, pixels;
+  long bytes;
+
+  int frames;
+  double start, total;
+};
+
+extern struct profile prof;
+
+double
+profile_clock();
+
+void
+profile_start(int);
+
+void
+profile_op(int, int, double);
+
+void
+profile_stop(int);
+
+char*
+opcode_name(int);
+
+void
+print_profile();
+
+void
+save_profile_json(char*);
+
+#endif
@@ -0,0 +1,921 @@
+/*
+Ray tracing backend, used by shading raytrace. Polygon commands hand their
+transformed triangles to rt_add instead of rasterizing them, and rt_render
+traces the whole frame at once before it is saved or displayed.
+
+The triangles go into a bounding volume hierarchy built with a binned
+surface area heuristic. When a frame has as many triangles as the last one
+(usually only knob transforms changed), the tree is refit to the new
+positions instead, unless that makes it much worse than a fresh build.
+
+The view is the same orthographic one as the rasterizer's: one ray per
+pixel center, looking down -z. Rays take the nearest triangle whichever way
+it winds, lit from the side that faces the viewer, so meshes wound the
+other way round show their outside instead of the inside of their far
+half. Rays are traced in packets of
+RT_PACKET x RT_PACKET that share a direction, so each node is visited once
+per packet and the parts of the triangle test that only depend on the
+direction are worked out once. Every hit sends a packet of shadow rays
+towards each light facing it, and lights that are blocked are left out of
+the lighting. Lighting uses the same constants, lights and get_lighting as
+draw_polygons. Tiles are shared out between threads.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gmath.h"
+#include "matrix.h"
+#include "ml6.h"
+#include "perfctr.h"
+#include "profile.h"
+#include "raytrace.h"
+
+struct ray_tracer rt;
+
+struct rt_packet
+{
+  int n;
+  double o[RT_RAYS][3];
+  double d[3], inv[3];
+  double t[RT_RAYS];
+  int hit[RT_RAYS];
+  /* shadow rays stop at the first thing they hit */
+  int primary;
+};
+
+/* what the worker threads are rendering */
+static struct
+{
+  struct point_t (*s)[YRES];
+  depth_t (*zb)[YRES];
+  double* view;
+  color ambient;
+  double (*light)[2][3];
+  double top;
+  int tiles, next;
+} job;
+
+struct rt_worker
+{
+  pthread_t thread;
+  long pixels, depth_tests;
+};
+
+static void
+grow_bounds(double* min, double* max, double* p)
+{
+  /*
+  Extend min and max to take in the point p.
+
+  @param: double* min
+  @param: double* max
+  @param: double* p
+
+  @return: void
+  */
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    min[j] = p[j] < min[j] ? p[j] : min[j];
+    max[j] = p[j] > max[j] ? p[j] : max[j];
+  }
+}
+
+static void
+merge_bounds(double* min, double* max, double* other_min, double* other_max)
+{
+  /*
+  Extend min and max to take in the box from other_min to other_max, which
+  may be empty.
+
+  @param: double* min
+  @param: double* max
+  @param: double* other_min
+  @param: double* other_max
+
+  @return: void
+  */
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    min[j] = other_min[j] < min[j] ? other_min[j] : min[j];
+    max[j] = other_max[j] > max[j] ? other_max[j] : max[j];
+  }
+}
+
+static void
+triangle_bounds(struct rt_triangle* tri, double* min, double* max)
+{
+  /*
+  Extend min and max to take in triangle tri.
+
+  @param: struct rt_triangle* tri
+  @param: double* min
+  @param: double* max
+
+  @return: void
+  */
+  double p[3];
+  int j;
+
+  grow_bounds(min, max, tri->v0);
+  for (j = 0; j < 3; j++)
+    p[j] = tri->v0[j] + tri->e1[j];
+  grow_bounds(min, max, p);
+  for (j = 0; j < 3; j++)
+    p[j] = tri->v0[j] + tri->e2[j];
+  grow_bounds(min, max, p);
+}
+
+static void
+empty_bounds(double* min, double* max)
+{
+  /*
+  Set min and max to bounds that take in nothing.
+
+  @param: double* min
+  @param: double* max
+
+  @return: void
+  */
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    min[j] = DBL_MAX;
+    max[j] = -DBL_MAX;
+  }
+}
+
+static double
+half_area(double* min, double* max)
+{
+  /*
+  Half the surface area of a box, 0 for an empty one.
+
+  @param: double* min
+  @param: double* max
+
+  @return: double
+  */
+  double x = max[0] - min[0];
+  double y = max[1] - min[1];
+  double z = max[2] - min[2];
+
+  if (x < 0 || y < 0 || z < 0)
+    return 0;
+  return x * y + y * z + z * x;
+}
+
+static double
+tree_cost()
+{
+  /*
+  Surface area heuristic cost of the tree, relative to its root.
+
+  @param: No parameters
+
+  @return: double
+  */
+  int i;
+  double cost = 0;
+  double root = half_area(rt.nodes[0].min, rt.nodes[0].max);
+  struct rt_node* node;
+
+  for (i = 0; i < rt.nodes_used; i++) {
+    node = &rt.nodes[i];
+    cost += half_area(node->min, node->max) *
+            (node->count ? node->count : RT_TRAVERSAL_COST);
+  }
+  return root > 0 ? cost / root : cost;
+}
+
+static void
+node_bounds(struct rt_node* node)
+{
+  /*
+  Work out the bounds of a leaf from the boxes of its triangles, or of any
+  other node from its children.
+
+  @param: struct rt_node* node
+
+  @return: void
+  */
+  int i;
+
+  empty_bounds(node->min, node->max);
+  if (node->count) {
+    for (i = node->first; i < node->first + node->count; i++)
+      merge_bounds(node->min,
+                   node->max,
+                   &rt.boxes[6 * rt.order[i]],
+                   &rt.boxes[6 * rt.order[i] + 3]);
+  } else {
+    merge_bounds(node->min,
+                 node->max,
+                 rt.nodes[node->first].min,
+                 rt.nodes[node->first].max);
+    merge_bounds(node->min,
+                 node->max,
+                 rt.nodes[node->first + 1].min,
+                 rt.nodes[node->first + 1].max);
+  }
+}
+
+static int
+bin_of(int i, int axis, double low, double scale)
+{
+  /*
+  Bin that the centroid of triangle i falls in along axis.
+
+  @param: int i
+  @param: int axis
+  @param: double low
+  @param: double scale
+
+  @return: int
+  */
+  int b = (int)((rt.centroids[3 * i + axis] - low) * scale);
+
+  return b < 0 ? 0 : b >= RT_BINS ? RT_BINS - 1 : b;
+}
+
+static int
+split_node(struct rt_node* node,
+           int* axis,
+           int* split,
+           double* low,
+           double* scale)
+{
+  /*
+  Find the best split of a node's triangles between RT_BINS bins along the
+  axis where their centroids are most spread out. Returns 0 if the node is
+  better off as a leaf.
+
+  @param: struct rt_node* node
+  @param: int* axis
+  @param: int* split
+  @param: double* low
+  @param: double* scale
+
+  @return: int
+  */
+  double cmin[3], cmax[3];
+  double bmin[RT_BINS][3], bmax[RT_BINS][3];
+  double lmin[3], lmax[3], rmin[3], rmax[3];
+  double left_area[RT_BINS];
+  int count[RT_BINS], left_count[RT_BINS];
+  double best, cost;
+  int a, b, i, right;
+
+  empty_bounds(cmin, cmax);
+  for (i = node->first; i < node->first + node->count; i++)
+    grow_bounds(cmin, cmax, &rt.centroids[3 * rt.order[i]]);
+
+  a = 0;
+  if (cmax[1] - cmin[1] > cmax[a] - cmin[a])
+    a = 1;
+  if (cmax[2] - cmin[2] > cmax[a] - cmin[a])
+    a = 2;
+  if (cmax[a] - cmin[a] <= 0)
+    return 0;
+  *axis = a;
+  *low = cmin[a];
+  *scale = RT_BINS / (cmax[a] - cmin[a]);
+
+  for (b = 0; b < RT_BINS; b++) {
+    count[b] = 0;
+    empty_bounds(bmin[b], bmax[b]);
+  }
+  for (i = node->first; i < node->first + node->count; i++) {
+    b = bin_of(rt.order[i], a, *low, *scale);
+    count[b]++;
+    merge_bounds(bmin[b],
+                 bmax[b],
+                 &rt.boxes[6 * rt.order[i]],
+                 &rt.boxes[6 * rt.order[i] + 3]);
+  }
+
+  empty_bounds(lmin, lmax);
+  for (b = 0, i = 0; b < RT_BINS - 1; b++) {
+    i += count[b];
+    merge_bounds(lmin, lmax, bmin[b], bmax[b]);
+    left_count[b] = i;
+    left_area[b] = half_area(lmin, lmax);
+  }
+
+  best = node->count * half_area(node->min, node->max);
+  *split = -1;
+  empty_bounds(rmin, rmax);
+  for (b = RT_BINS - 1, right = 0; b > 0; b--) {
+    right += count[b];
+    merge_bounds(rmin, rmax, bmin[b], bmax[b]);
+    if (!left_count[b - 1] || !right)
+      continue;
+    cost = RT_TRAVERSAL_COST * half_area(node->min, node->max) +
+           left_count[b - 1] * left_area[b - 1] +
+           right * half_area(rmin, rmax);
+    if (cost < best) {
+      best = cost;
+      *split = b - 1;
+    }
+  }
+
+  /* too many triangles for one leaf: split in the middle */
+  if (*split < 0 && node->count > RT_MAX_LEAF)
+    *split = RT_BINS / 2 - 1;
+  return *split >= 0;
+}
+
+static void
+triangle_boxes()
+{
+  /*
+  Work out the bounding box of every triangle, and for building, its
+  centroid.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i, k;
+  double* box;
+
+  for (i = 0; i < rt.count; i++) {
+    box = &rt.boxes[6 * i];
+    empty_bounds(box, box + 3);
+    triangle_bounds(&rt.triangles[i], box, box + 3);
+    for (k = 0; k < 3; k++)
+      rt.centroids[3 * i + k] = (box[k] + box[k + 3]) / 2;
+  }
+}
+
+static void
+build_tree()
+{
+  /*
+  Build the tree over all of the frame's triangles.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int stack[RT_STACK];
+  int top = 0;
+  int i, j, k, axis, split, left;
+  double low, scale;
+  struct rt_node* node;
+
+  for (i = 0; i < rt.count; i++)
+    rt.order[i] = i;
+
+  rt.nodes[0].first = 0;
+  rt.nodes[0].count = rt.count;
+  rt.nodes_used = 1;
+  stack[top++] = 0;
+
+  while (top) {
+    node = &rt.nodes[stack[--top]];
+    node_bounds(node);
+    if (node->count <= RT_LEAF_SIZE || top + 2 > RT_STACK ||
+        !split_node(node, &axis, &split, &low, &scale))
+      continue;
+
+    i = node->first;
+    j = node->first + node->count - 1;
+    while (i <= j) {
+      if (bin_of(rt.order[i], axis, low, scale) <= split)
+        i++;
+      else {
+        k = rt.order[i];
+        rt.order[i] = rt.order[j];
+        rt.order[j--] = k;
+      }
+    }
+    i -= node->first;
+    if (i == 0 || i == node->count)
+      continue;
+
+    left = rt.nodes_used;
+    rt.nodes_used += 2;
+    rt.nodes[left].first = node->first;
+    rt.nodes[left].count = i;
+    rt.nodes[left + 1].first = node->first + i;
+    rt.nodes[left + 1].count = node->count - i;
+    node->first = left;
+    node->count = 0;
+    stack[top++] = left + 1;
+    stack[top++] = left;
+  }
+
+  rt.built_count = rt.count;
+  rt.built_cost = tree_cost();
+  rt.builds++;
+}
+
+static void
+refit_tree()
+{
+  /*
+  Move the bounds of every node to the triangles' new positions. Children
+  always come after their parent, so a backwards sweep sees them first.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  for (i = rt.nodes_used - 1; i >= 0; i--)
+    node_bounds(&rt.nodes[i]);
+  rt.refits++;
+}
+
+static void
+update_tree()
+{
+  /*
+  Refit the tree if the frame has the same triangles as the one it was
+  built for and it has not got too much worse, otherwise rebuild it.
+
+  @param: No parameters
+
+  @return: void
+  */
+  if (rt.count > rt.node_capacity / 2) {
+    free(rt.nodes);
+    free(rt.order);
+    free(rt.centroids);
+    free(rt.boxes);
+    rt.node_capacity = 2 * rt.count;
+    rt.nodes =
+      (struct rt_node*)malloc(rt.node_capacity * sizeof(struct rt_node));
+    rt.order = (int*)malloc(rt.count * sizeof(int));
+    rt.centroids = (double*)malloc(3 * rt.count * sizeof(double));
+    rt.boxes = (double*)malloc(6 * rt.count * sizeof(double));
+    rt.built_count = -1;
+  }
+
+  triangle_boxes();
+
+  if (rt.count == rt.built_count) {
+    refit_tree();
+    if (tree_cost() <= RT_REFIT_LIMIT * rt.built_cost)
+      return;
+  }
+  build_tree();
+}
+
+static int
+hit_box(struct rt_packet* p, int k, double* min, double* max)
+{
+  /*
+  Whether ray k of the packet meets the box before its nearest hit.
+
+  @param: struct rt_packet* p
+  @param: int k
+  @param: double* min
+  @param: double* max
+
+  @return: int
+  */
+  double t0 = RT_EPSILON;
+  double t1 = p->t[k];
+  double a, b, swap;
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    if (p->d[j] == 0) {
+      if (p->o[k][j] < min[j] || p->o[k][j] > max[j])
+        return 0;
+      continue;
+    }
+    a = (min[j] - p->o[k][j]) * p->inv[j];
+    b = (max[j] - p->o[k][j]) * p->inv[j];
+    if (a > b)
+      swap = a, a = b, b = swap;
+    t0 = a > t0 ? a : t0;
+    t1 = b < t1 ? b : t1;
+    if (t0 > t1)
+      return 0;
+  }
+  return 1;
+}
+
+static void
+hit_leaf(struct rt_packet* p, struct rt_node* node, int first)
+{
+  /*
+  Test rays first onwards against the triangles of a leaf
+  (Moller-Trumbore). The cross product of the direction with the second
+  edge is shared by the whole packet.
+
+  @param: struct rt_packet* p
+  @param: struct rt_node* node
+  @param: int first
+
+  @return: void
+  */
+  struct rt_triangle* tri;
+  double pv[3], s[3], q[3];
+  double det, inverse, u, v, t;
+  int i, k;
+
+  for (i = node->first; i < node->first + node->count; i++) {
+    tri = &rt.triangles[rt.order[i]];
+    pv[0] = p->d[1] * tri->e2[2] - p->d[2] * tri->e2[1];
+    pv[1] = p->d[2] * tri->e2[0] - p->d[0] * tri->e2[2];
+    pv[2] = p->d[0] * tri->e2[1] - p->d[1] * tri->e2[0];
+    det = tri->e1[0] * pv[0] + tri->e1[1] * pv[1] + tri->e1[2] * pv[2];
+    if (fabs(det) < 1e-12)
+      continue;
+    inverse = 1 / det;
+
+    for (k = first; k < p->n; k++) {
+      s[0] = p->o[k][0] - tri->v0[0];
+      s[1] = p->o[k][1] - tri->v0[1];
+      s[2] = p->o[k][2] - tri->v0[2];
+      u = (s[0] * pv[0] + s[1] * pv[1] + s[2] * pv[2]) * inverse;
+      if (u < 0 || u > 1)
+        continue;
+      q[0] = s[1] * tri->e1[2] - s[2] * tri->e1[1];
+      q[1] = s[2] * tri->e1[0] - s[0] * tri->e1[2];
+      q[2] = s[0] * tri->e1[1] - s[1] * tri->e1[0];
+      v = (p->d[0] * q[0] + p->d[1] * q[1] + p->d[2] * q[2]) * inverse;
+      if (v < 0 || u + v > 1)
+        continue;
+      t = (tri->e2[0] * q[0] + tri->e2[1] * q[1] + tri->e2[2] * q[2]) *
+          inverse;
+      if (t > RT_EPSILON && t < p->t[k]) {
+        p->hit[k] = rt.order[i];
+        /* a shadow ray is done once anything is in the way */
+        p->t[k] = p->primary ? t : -1;
+      }
+    }
+  }
+}
+
+static void
+trace_packet(struct rt_packet* p)
+{
+  /*
+  Find what each ray of the packet hits. A node is entered if any ray of
+  the packet meets it, and only rays from the first of those on are tested
+  further down. The nearer child is visited first.
+
+  @param: struct rt_packet* p
+
+  @return: void
+  */
+  int stack[RT_STACK];
+  int top = 0;
+  int k, near;
+  double a, b;
+  struct rt_node* node;
+  struct rt_node* child;
+
+  for (k = 0; k < 3; k++)
+    p->inv[k] = p->d[k] != 0 ? 1 / p->d[k] : 0;
+
+  stack[top++] = 0;
+  while (top) {
+    node = &rt.nodes[stack[--top]];
+    for (k = 0; k < p->n; k++)
+      if (hit_box(p, k, node->min, node->max))
+        break;
+    if (k == p->n)
+      continue;
+
+    if (node->count) {
+      hit_leaf(p, node, k);
+      continue;
+    }
+
+    child = &rt.nodes[node->first];
+    a = (child[0].min[0] + child[0].max[0]) * p->d[0] +
+        (child[0].min[1] + child[0].max[1]) * p->d[1] +
+        (child[0].min[2] + child[0].max[2]) * p->d[2];
+    b = (child[1].min[0] + child[1].max[0]) * p->d[0] +
+        (child[1].min[1] + child[1].max[1]) * p->d[1] +
+        (child[1].min[2] + child[1].max[2]) * p->d[2];
+    near = a <= b ? 0 : 1;
+    stack[top++] = node->first + 1 - near;
+    stack[top++] = node->first + near;
+  }
+}
+
+static color
+shade(struct rt_triangle* tri, int blocked)
+{
+  /*
+  Color of a triangle with the lights in the bit mask blocked left out.
+
+  @param: struct rt_triangle* tri
+  @param: int blocked
+
+  @return: color
+  */
+  double light[MAX_LIGHTS][2][3];
+  double normal[3];
+  int n, lights = 0;
+
+  if (!blocked)
+    return tri->c;
+
+  for (n = 0; n < tri->lights; n++)
+    if (!(blocked & (1 << n)))
+      memcpy(light[lights++], job.light[n], sizeof(light[0]));
+  memcpy(normal, tri->normal, sizeof(normal));
+  return get_lighting(
+    normal, job.view, job.ambient, lights, light, tri->reflect);
+}
+
+static void
+render_tile(int tile, struct rt_worker* worker)
+{
+  /*
+  Trace the primary and shadow rays of one packet's worth of pixels and
+  write the ones in front of what is already in the zbuffer.
+
+  @param: int tile
+  @param: struct rt_worker* worker
+
+  @return: void
+  */
+  struct rt_packet p, shadow;
+  struct rt_triangle* tri;
+  int across = (XRES + RT_PACKET - 1) / RT_PACKET;
+  int x0 = tile % across * RT_PACKET;
+  int y0 = tile / across * RT_PACKET;
+  int x[RT_RAYS], y[RT_RAYS], blocked[RT_RAYS], index[RT_RAYS];
+  double normal[3], lvector[3];
+  double z;
+  depth_t depth;
+  int i, k, n, row;
+  int lights = 0;
+
+  p.n = 0;
+  p.primary = 1;
+  p.d[0] = p.d[1] = 0;
+  p.d[2] = -1;
+  for (i = 0; i < RT_RAYS; i++) {
+    if (x0 + i % RT_PACKET >= XRES || y0 + i / RT_PACKET >= YRES)
+      continue;
+    x[p.n] = x0 + i % RT_PACKET;
+    y[p.n] = y0 + i / RT_PACKET;
+    p.o[p.n][0] = x[p.n] + 0.5;
+    p.o[p.n][1] = y[p.n] + 0.5;
+    p.o[p.n][2] = job.top;
+    p.t[p.n] = DBL_MAX;
+    p.hit[p.n] = -1;
+    p.n++;
+  }
+  trace_packet(&p);
+
+  /* keep the hits in front of lines already drawn, as plot would */
+  for (k = 0; k < p.n; k++) {
+    blocked[k] = 0;
+    if (p.hit[k] < 0)
+      continue;
+    z = p.o[k][2] - p.t[k];
+    depth = DEPTH_ENCODE((int)(z * 1000) / 1000.0);
+    row = YRES - 1 - y[k];
+    worker->depth_tests++;
+    if (!DEPTH_TEST(job.zb[x[k]][row], depth)) {
+      p.hit[k] = -1;
+      continue;
+    }
+    job.zb[x[k]][row] = depth;
+    if (rt.triangles[p.hit[k]].lights > lights)
+      lights = rt.triangles[p.hit[k]].lights;
+  }
+
+  /* one packet of shadow rays per light, all in the light's direction */
+  shadow.primary = 0;
+  for (n = 0; n < lights; n++) {
+    memcpy(lvector, job.light[n][0], sizeof(lvector));
+    normalize(lvector);
+    memcpy(shadow.d, lvector, sizeof(lvector));
+    shadow.n = 0;
+    for (k = 0; k < p.n; k++) {
+      if (p.hit[k] < 0)
+        continue;
+      tri = &rt.triangles[p.hit[k]];
+      if (n >= tri->lights)
+        continue;
+      memcpy(normal, tri->normal, sizeof(normal));
+      normalize(normal);
+      if (dot_product(normal, lvector) <= 0)
+        continue;
+      for (i = 0; i < 3; i++)
+        shadow.o[shadow.n][i] = p.o[k][i] + p.t[k] * p.d[i];
+      shadow.t[shadow.n] = DBL_MAX;
+      shadow.hit[shadow.n] = -1;
+      index[shadow.n++] = k;
+    }
+    if (!shadow.n)
+      continue;
+    trace_packet(&shadow);
+    for (i = 0; i < shadow.n; i++)
+      if (shadow.hit[i] >= 0)
+        blocked[index[i]] |= 1 << n;
+  }
+
+  for (k = 0; k < p.n; k++) {
+    if (p.hit[k] < 0)
+      continue;
+    job.s[x[k]][YRES - 1 - y[k]] = shade(&rt.triangles[p.hit[k]], blocked[k]);
+    worker->pixels++;
+  }
+}
+
+static void*
+render_tiles(void* arg)
+{
+  /*
+  Body of a worker thread: render tiles until there are none left.
+
+  @param: void* arg
+
+  @return: void*
+  */
+  struct rt_worker* worker = (struct rt_worker*)arg;
+  int tile;
+
+  while ((tile = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED)) <
+         job.tiles)
+    render_tile(tile, worker);
+  return NULL;
+}
+
+void
+rt_start()
+{
+  /*
+  Reset the ray tracer and decide how many threads to trace with.
+
+  @param: No parameters
+
+  @return: void
+  */
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  memset(&rt, 0, sizeof(rt));
+  rt.built_count = -1;
+  rt.threads = cpus < 1 ? 1 : cpus > RT_MAX_THREADS ? RT_MAX_THREADS : cpus;
+}
+
+void
+rt_clear()
+{
+  /*
+  Forget the triangles of the last frame. The tree is kept to be refit.
+
+  @param: No parameters
+
+  @return: void
+  */
+  rt.count = 0;
+  rt.traced = 0;
+}
+
+void
+rt_add(struct matrix* polygons, int lights, struct constants* reflect)
+{
+  /*
+  Add the triangles in polygons to the frame, lit by the first lights
+  lights with reflect, the same as draw_polygons would light them.
+
+  @param: struct matrix* polygons
+  @param: int lights
+  @param: struct constants* reflect
+
+  @return: void
+  */
+  int point, j;
+  struct rt_triangle* tri;
+
+  for (point = 0; point < polygons->lastcol - 2; point += 3) {
+    if (rt.count == rt.capacity) {
+      rt.capacity = rt.capacity ? 2 * rt.capacity : 1024;
+      rt.triangles = (struct rt_triangle*)realloc(
+        rt.triangles, rt.capacity * sizeof(struct rt_triangle));
+    }
+    tri = &rt.triangles[rt.count++];
+    for (j = 0; j < 3; j++) {
+      tri->v0[j] = polygons->m[j][point];
+      tri->e1[j] = polygons->m[j][point + 1] - polygons->m[j][point];
+      tri->e2[j] = polygons->m[j][point + 2] - polygons->m[j][point];
+    }
+    /* as calculate_normal, but turned towards the viewer */
+    tri->normal[0] = tri->e1[1] * tri->e2[2] - tri->e1[2] * tri->e2[1];
+    tri->normal[1] = tri->e1[2] * tri->e2[0] - tri->e1[0] * tri->e2[2];
+    tri->normal[2] = tri->e1[0] * tri->e2[1] - tri->e1[1] * tri->e2[0];
+    prof.triangles++;
+    /* a triangle with no area has no normal to light it by, and covers
+       no pixels, as in scanline_convert */
+    if (tri->normal[0] == 0 && tri->normal[1] == 0 && tri->normal[2] == 0) {
+      rt.count--;
+      prof.culled++;
+      continue;
+    }
+    if (tri->normal[2] < 0)
+      for (j = 0; j < 3; j++)
+        tri->normal[j] = -tri->normal[j];
+    tri->lights = lights;
+    tri->reflect = reflect;
+  }
+}
+
+void
+rt_render(screen s,
+          zbuffer zb,
+          double* view,
+          color ambient,
+          double light[MAX_LIGHTS][2][3])
+{
+  /*
+  Trace the triangles added so far into s and zb. Does nothing if there is
+  nothing new since the last call in this frame.
+
+  @param: screen s
+  @param: zbuffer zb
+  @param: double* view
+  @param: color ambient
+  @param: double light[MAX_LIGHTS][2][3]
+
+  @return: void
+  */
+  struct rt_worker workers[RT_MAX_THREADS];
+  double normal[3];
+  int i, started;
+  int stage = perf.stage;
+
+  if (rt.count == rt.traced)
+    return;
+  rt.traced = rt.count;
+
+  perf_stage(STAGE_GEOMETRY);
+  update_tree();
+
+  job.s = s;
+  job.zb = zb;
+  job.view = view;
+  job.ambient = ambient;
+  job.light = light;
+  job.top = rt.nodes[0].max[2] + 1;
+  job.tiles = ((XRES + RT_PACKET - 1) / RT_PACKET) *
+              ((YRES + RT_PACKET - 1) / RT_PACKET);
+  job.next = 0;
+
+  /* unshadowed colors, which most pixels get */
+  perf_stage(STAGE_LIGHTING);
+  for (i = 0; i < rt.count; i++) {
+    memcpy(normal, rt.triangles[i].normal, sizeof(normal));
+    rt.triangles[i].c = get_lighting(normal,
+                                     view,
+                                     ambient,
+                                     rt.triangles[i].lights,
+                                     light,
+                                     rt.triangles[i].reflect);
+  }
+
+  perf_stage(STAGE_RASTER);
+  memset(workers, 0, sizeof(workers));
+  for (started = 1; started < rt.threads; started++)
+    if (pthread_create(
+          &workers[started].thread, NULL, render_tiles, &workers[started]))
+      break;
+  render_tiles(&workers[0]);
+  for (i = 1; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  for (i = 0; i < started; i++) {
+    prof.pixels += workers[i].pixels;
+    prof.depth_tests += workers[i].depth_tests;
+  }
+  perf_stage(stage);
+}
+
+void
+rt_stop()
+{
+  /*
+  Free the triangles and the tree.
+
+  @param: No parameters
+
+  @return: void
+  */
+  free(rt.triangles);
+  free(rt.nodes);
+  free(rt.order);
+  free(rt.centroids);
+  free(rt.boxes);
+  memset(&rt, 0, sizeof(rt));
+}
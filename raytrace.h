@@ -0,0 +1,77 @@
+#ifndef RAYTRACE_H
+#define RAYTRACE_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+
+/* packets are RT_PACKET x RT_PACKET pixels, traced together */
+#define RT_PACKET 4
+#define RT_RAYS (RT_PACKET * RT_PACKET)
+#define RT_BINS 16
+#define RT_LEAF_SIZE 4
+#define RT_MAX_LEAF 16
+#define RT_TRAVERSAL_COST 1.0
+#define RT_STACK 128
+#define RT_MAX_THREADS 16
+#define RT_EPSILON 1e-4
+/* rebuild instead of refitting once the tree is this much worse */
+#define RT_REFIT_LIMIT 1.5
+
+struct rt_triangle
+{
+  double v0[3], e1[3], e2[3];
+  double normal[3];
+  int lights;
+  struct constants* reflect;
+  color c;
+};
+
+struct rt_node
+{
+  double min[3], max[3];
+  /* leaves hold count triangles from order[first], other nodes have
+     count 0 and their children at first and first + 1 */
+  int first, count;
+};
+
+struct ray_tracer
+{
+  struct rt_triangle* triangles;
+  int count, capacity;
+  int traced;
+
+  int* order;
+  double* centroids;
+  double* boxes;
+  struct rt_node* nodes;
+  int nodes_used, node_capacity;
+  int built_count;
+  double built_cost;
+
+  int threads;
+  long builds, refits;
+};
+
+extern struct ray_tracer rt;
+
+void
+rt_start();
+
+void
+rt_clear();
+
+void
+rt_add(struct matrix*, int, struct constants*);
+
+void
+rt_render(screen,
+          zbuffer,
+          double*,
+          color,
+          double light[MAX_LIGHTS][2][3]);
+
+void
+rt_stop();
+
+#endif
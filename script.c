@@ -2,37 +2,86 @@
 Serve as the interpreter for mdl.
 When an mdl script goes through a lexer and parser,
 the resulting operations will be in the array op[].
+They are compiled into program[] once and that is run for every frame.
 */
 
+#include "compile.h"
 #include "parser.h"
 #include "symtab.h"
 #include "y.tab.h"
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "arena.h"
 #include "display.h"
 #include "draw.h"
+#include "framecache.h"
 #include "gmath.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "meshcache.h"
+#include "msaa.h"
 #include "ml6.h"
+#include "options.h"
+#include "perfctr.h"
+#include "preview.h"
+#include "profile.h"
+#include "raytrace.h"
+#include "server.h"
+#include "shadow.h"
 #include "stack.h"
+#include "stream.h"
+#include "texture.h"
+#include "wireframe.h"
+#include "writer.h"
 
-void
+static void
+script_error(int status, char* format, ...)
+{
+  /*
+  Report why the script cannot be run. A run of one script exits with
+  status, as it always has. With several scripts the caller gives up on
+  this one and batch counts it as failed, and under --server the message
+  also goes to the job's client.
+
+  @param: int status
+  @param: char* format
+  @param: ...
+
+  @return: void
+  */
+  char message[512];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  printf("Error: %s\n", message);
+  if (!server.serving && opts.script_count < 2)
+    exit(status);
+  server_event("error %s\n", message);
+}
+
+int
 first_pass()
 {
   /*
   Checks the op array for any animation commands (frames, basename, vary).
   Should set num_frames and basename if the frames or basename commands are
-  present. If vary is found, but frames is not, the entire program should exit.
-  If frames is found, but basename is not, set name to some default value, and
-  print out a message with the name being used.
+  present. If frames is found, but basename is not, set name to some default
+  value, and print out a message with the name being used.
+
+  Returns 0 if the script cannot be run: vary without frames, or a vary or
+  tween whose range ends before it starts.
 
   @param: No parameters
 
-  @return: void
+  @return: int
   */
   int i;
   char vary_check = 0;
@@ -52,11 +101,24 @@ first_pass()
       name_check = 1;
     } else if (op[i].opcode == VARY) {
       vary_check = 1;
+      if (op[i].op.vary.end_frame < op[i].op.vary.start_frame) {
+        script_error(-1,
+                     "end frame is before start frame for knob: %s",
+                     op[i].op.vary.p->name);
+        return 0;
+      }
+    } else if (op[i].opcode == TWEEN &&
+               op[i].op.tween.end_frame < op[i].op.tween.start_frame) {
+      script_error(-1,
+                   "end frame is before start frame for tween from %s to %s",
+                   op[i].op.tween.knob_list0->name,
+                   op[i].op.tween.knob_list1->name);
+      return 0;
     }
 
     if (vary_check && !frame_check) {
-      printf("Error: Vary command found but number of frames not set\b");
-      exit(0);
+      script_error(0, "Vary command found but number of frames not set");
+      return 0;
     }
     if (frame_check && vary_check && !name_check) {
       printf("Warning: Animation code present but basename not set. Using "
@@ -64,98 +126,425 @@ first_pass()
       strncpy(name, "frame", sizeof(name));
     }
   }
+  return 1;
 }
 
-struct vary_node**
-second_pass()
+int
+frame_range(int* start, int* end)
 {
   /*
-  Each index should contain a linked list of vary_nodes, each node contains a
-  knob name, a value, and a pointer to the next node.
+  Work out which frames this run renders from --frames and --shard. The
+  shard is the K-th of N contiguous blocks of the --frames range, or of the
+  whole animation. Returns 0 if there are no such frames.
 
-  @param: No paramters
+  @param: int* start
+  @param: int* end
+
+  @return: int
+  */
+  int first = opts.first;
+  int last = opts.last < 0 || opts.last >= num_frames ? num_frames - 1
+                                                      : opts.last;
+  int count;
+
+  if (first > last) {
+    script_error(1,
+                 "--frames starts at %d but there are only %d frames",
+                 first,
+                 num_frames);
+    return 0;
+  }
+
+  count = last - first + 1;
+  *start = first + (long)count * opts.shard / opts.shards;
+  *end = first + (long)count * (opts.shard + 1) / opts.shards - 1;
+  return 1;
+}
+
+void
+frame_file(char* file, int f)
+{
+  /*
+  Name of the image for frame f in anim/. The frame number has at least 3
+  digits, and as many as the last frame needs so the files sort in order.
+
+  @param: char* file
+  @param: int f
+
+  @return: void
+  */
+  int width = 3;
+  int n;
+
+  for (n = num_frames - 1; n >= 1000; n /= 10)
+    width++;
+  sprintf(file, "anim/%s_%0*d.%s", name, width, f, opts.format);
+}
+
+int
+assemble()
+{
+  /*
+  Make the animation out of frames rendered earlier, usually by several
+  --shard runs, after checking that none of them is missing. Returns 0 if
+  some are.
 
-  @return: struct vary_node** knobs
+  @param: No parameters
+
+  @return: int
   */
-  int i, k;
-  int start_frame, end_frame;
-  double start_value, end_value, delta;
-  struct vary_node* curr = NULL;
-  struct vary_node** knobs;
-  knobs = (struct vary_node**)calloc(num_frames, sizeof(struct vary_node*));
+  int f;
+  int missing = 0;
+  char file[200];
 
+  for (f = 0; f < num_frames; f++) {
+    frame_file(file, f);
+    if (access(file, F_OK) != 0) {
+      if (missing < 10)
+        printf("Error: %s is missing\n", file);
+      missing++;
+    }
+  }
+  if (missing) {
+    script_error(
+      1, "%d of %d frames are missing, not assembling", missing, num_frames);
+    return 0;
+  }
+  make_animation(name);
+  return 1;
+}
+
+static SYMTAB*
+knob_symbol(int i)
+{
+  /*
+  Return the knob op[i] uses, or NULL if it has none.
+
+  @param: int i
+
+  @return: SYMTAB*
+  */
+  switch (op[i].opcode) {
+    case MOVE:
+      return op[i].op.move.p;
+    case SCALE:
+      return op[i].op.scale.p;
+    case ROTATE:
+      return op[i].op.rotate.p;
+    case LIGHT:
+      return op[i].op.light.b;
+    case SET:
+      return op[i].op.set.p;
+    case VARY:
+      return op[i].op.vary.p;
+  }
+  return NULL;
+}
+
+static void
+clip_frames(struct knob_table* table, int* first, int* last)
+{
+  /*
+  Clip a frame range from vary or tween to the frames table has rows for.
+
+  @param: struct knob_table* table
+  @param: int* first
+  @param: int* last
+
+  @return: void
+  */
+  if (*first < table->start)
+    *first = table->start;
+  if (*last > table->end)
+    *last = table->end;
+}
+
+struct knob_table*
+second_pass(int start, int end)
+{
+  /*
+  Work out the value of every knob in frames start to end, the frames
+  this run renders, once, into a table with a row per frame. The commands
+  are taken in the order they appear: save_knobs keeps the values set and
+  setknobs have given the knobs so far as a named list, vary changes one
+  knob over a range of frames, and tween changes every knob from one saved
+  list to another over a range of frames. Outside the ranges that change
+  them, knobs keep the last value they were set to (0 if there is none).
+  The values are printed.
+
+  @param: int start
+  @param: int end
+
+  @return: struct knob_table*
+  */
+  int i, k, f, first, last, saved, count;
+  long c, cells;
+  int* index;
+  double delta, span, t;
+  double* base;
+  double* row;
+  double* lists;
+  double *list0, *list1;
+  char* varied;
+  SYMTAB** names;
+  SYMTAB* sym;
+  struct knob_table* table;
+
+  index = (int*)malloc((lastsym + 1) * sizeof(int));
+  for (i = 0; i < lastsym; i++)
+    index[i] = -1;
+
+  table = (struct knob_table*)calloc(1, sizeof(struct knob_table));
+  table->knobs = (SYMTAB**)malloc((lastop + 1) * sizeof(SYMTAB*));
   for (i = 0; i < lastop; i++) {
-    if (op[i].opcode == VARY) {
-      start_frame = op[i].op.vary.start_frame;
-      end_frame = op[i].op.vary.end_frame;
-      start_value = op[i].op.vary.start_val;
-      end_value = op[i].op.vary.end_val;
-      delta = (end_value - start_value) / (end_frame - start_frame);
-
-      if (end_frame < start_frame) {
-        printf("Error: end frame is before start frame for knob: %s\n",
-               op[i].op.vary.p->name);
-        exit(-1);
-      }
-      for (k = 0; k < num_frames; k++) {
-        char found = 0;
-        curr = knobs[k];
-
-        while (curr) {
-          if (strncmp(curr->name, op[i].op.vary.p->name, sizeof(curr->name)) ==
-              0) {
-            found = 1;
+    sym = knob_symbol(i);
+    if (sym != NULL && index[sym->index] < 0) {
+      index[sym->index] = table->count;
+      table->knobs[table->count++] = sym;
+    }
+  }
+
+  count = table->count;
+  table->start = start;
+  table->end = end;
+  cells = (long)(end - start + 1) * count;
+  table->values = (double*)calloc(cells + 1, sizeof(double));
+  table->animated = (char*)calloc(count + 1, 1);
+  base = (double*)calloc(count + 1, sizeof(double));
+  lists = (double*)malloc(((long)lastop * count + 1) * sizeof(double));
+  names = (SYMTAB**)malloc((lastop + 1) * sizeof(SYMTAB*));
+  varied = (char*)calloc(cells + 1, 1);
+  saved = 0;
+
+  for (i = 0; i < lastop; i++) {
+    switch (op[i].opcode) {
+      case SET:
+        base[index[op[i].op.set.p->index]] = op[i].op.set.val;
+        break;
+
+      case SETKNOBS:
+        for (k = 0; k < count; k++)
+          base[k] = op[i].op.setknobs.value;
+        break;
+
+      case SAVE_KNOBS:
+        for (k = 0; k < saved; k++)
+          if (names[k] == op[i].op.save_knobs.p)
             break;
-          }
-          curr = curr->next;
+        if (k == saved)
+          names[saved++] = op[i].op.save_knobs.p;
+        memcpy(lists + k * count, base, count * sizeof(double));
+        break;
+
+      case VARY:
+        first = op[i].op.vary.start_frame;
+        last = op[i].op.vary.end_frame;
+        delta = last > first ? (op[i].op.vary.end_val -
+                                op[i].op.vary.start_val) /
+                                 (last - first)
+                             : 0;
+        k = index[op[i].op.vary.p->index];
+        table->animated[k] = 1;
+        f = first;
+        clip_frames(table, &f, &last);
+        for (; f <= last; f++) {
+          table->values[(f - start) * count + k] =
+            op[i].op.vary.start_val + (f - first) * delta;
+          varied[(f - start) * count + k] = 1;
+        }
+        break;
+
+      case TWEEN:
+        list0 = list1 = NULL;
+        for (k = 0; k < saved; k++) {
+          if (names[k] == op[i].op.tween.knob_list0)
+            list0 = lists + k * count;
+          if (names[k] == op[i].op.tween.knob_list1)
+            list1 = lists + k * count;
+        }
+        if (list0 == NULL || list1 == NULL) {
+          printf("Warning: tween from %s to %s uses a knob list that was "
+                 "not saved before it, skipping it\n",
+                 op[i].op.tween.knob_list0->name,
+                 op[i].op.tween.knob_list1->name);
+          break;
         }
 
-        if (!found) {
-          curr = (struct vary_node*)calloc(1, sizeof(struct vary_node));
-          strncpy(curr->name, op[i].op.vary.p->name, sizeof(curr->name));
-          curr->value = 0;
-          curr->next = knobs[k];
-          knobs[k] = curr;
+        first = op[i].op.tween.start_frame;
+        last = op[i].op.tween.end_frame;
+        memset(table->animated, 1, count);
+        span = last - first;
+        f = first;
+        clip_frames(table, &f, &last);
+        for (; f <= last; f++) {
+          t = span > 0 ? (f - first) / span : 0;
+          row = table->values + (f - start) * count;
+          for (k = 0; k < count; k++)
+            row[k] = list0[k] + (list1[k] - list0[k]) * t;
+          memset(varied + (f - start) * count, 1, count);
         }
+        break;
+    }
+  }
+
+  for (c = 0; c < cells; c++)
+    if (!varied[c])
+      table->values[c] = base[c % count];
+
+  for (c = 0; c < cells; c++)
+    if (table->animated[c % count])
+      printf("knob: %s\t%lf\n",
+             table->knobs[c % count]->name,
+             table->values[c]);
+
+  free(base);
+  free(lists);
+  free(names);
+  free(varied);
+  free(index);
+  return table;
+}
 
-        if (k == start_frame)
-          curr->value = start_value;
+void
+free_knobs(struct knob_table* table)
+{
+  /*
+  Release a table made by second_pass.
 
-        else if (k > start_frame && k <= end_frame)
-          curr->value = start_value + (k - start_frame) * delta;
+  @param: struct knob_table* table
 
-        printf("knob: %s\t%lf\n", curr->name, curr->value);
-      }
-    }
+  @return: void
+  */
+  free(table->knobs);
+  free(table->values);
+  free(table->animated);
+  free(table);
+}
+
+static struct matrix*
+draw_system(SYMTAB* cs, struct stack* systems)
+{
+  /*
+  Return the matrix to draw in: the saved coordinate system cs if there is
+  one, otherwise the top of systems.
+
+  @param: SYMTAB* cs
+  @param: struct stack* systems
+
+  @return: struct matrix*
+  */
+  return cs != NULL ? cs->s.m : peek(systems);
+}
+
+static void
+transform_ends(struct matrix* edge, struct matrix* m0, struct matrix* m1)
+{
+  /*
+  Transform the first point of edge by m0 and the second by m1, for a
+  line whose ends are in different coordinate systems.
+
+  @param: struct matrix* edge
+  @param: struct matrix* m0
+  @param: struct matrix* m1
+
+  @return: void
+  */
+  struct matrix end;
+  double* rows[4];
+  int r;
+
+  edge->lastcol = 1;
+  matrix_mult(m0, edge);
+  edge->lastcol = 2;
+
+  /* the second column on its own */
+  for (r = 0; r < 4; r++)
+    rows[r] = edge->m[r] + 1;
+  end.m = rows;
+  end.rows = 4;
+  end.cols = 1;
+  end.lastcol = 1;
+  end.arena = NULL;
+  matrix_mult(m1, &end);
+}
+
+static void
+finish_frame(screen** t, int f, char* frame_name, unsigned long long* checksum)
+{
+  /*
+  Send the finished image of frame f wherever this run puts frames, and
+  take a new screen from the writer if the image went to it.
+
+  @param: screen** t
+  @param: int f
+  @param: char* frame_name
+  @param: unsigned long long* checksum
+
+  @return: void
+  */
+  if (opts.preview)
+    preview_publish(**t, f);
+  if (opts.headless)
+    *checksum = checksum_screen(**t, *checksum);
+  else if (opts.stream) {
+    writer_submit(*t, WRITER_STREAM, NULL, -1);
+    *t = writer_acquire();
+  } else if (num_frames > 1) {
+    writer_submit(*t, WRITER_SAVE, frame_name, f);
+    *t = writer_acquire();
   }
-  return knobs;
+  perf_stage(STAGE_OTHER);
+  perf_frame(f);
+  if (opts.headless)
+    server_event("frame %d rendered %016llx\n", f, *checksum);
+  else if (opts.stream || num_frames < 2)
+    server_event("frame %d rendered\n", f);
 }
 
-void
+int
 script()
 {
   /*
-  Run a given MDL script.
+  Run a given MDL script. Returns 0 if it could not be run, or if the
+  video stream failed and rendering stopped early.
 
   @param: No paramters
 
-  @return: void
+  @return: int
   */
-  struct vary_node** knobs;
-  struct vary_node* vn;
-  first_pass();
-  knobs = second_pass();
+  struct knob_table* knobs;
+  double* row;
+  int k;
+  int start, end;
+  if (!first_pass() || !frame_range(&start, &end))
+    return 0;
+  if (opts.assemble)
+    return assemble();
+  knobs = second_pass(start, end);
+  compile();
+  print_pcode();
   char frame_name[200];
   int f;
 
-  int i;
+  int pc;
   int lights;
+  int shading;
+  double started;
+  unsigned long long checksum = CHECKSUM_SEED;
+  unsigned long long key;
+  int stopped;
+  struct instruction* ins;
+  struct command* cmd;
   struct matrix* tmp;
+  struct matrix* uvs;
+  struct matrix* transform;
   struct stack* systems;
-  screen t;
+  screen* t;
+  screen* copy;
   zbuffer zb;
   double step_3d = 100;
-  double theta, xval, yval, zval, knob_value;
+  double theta, knob_value;
+  int tmp_cols = 1000, uv_cols = 1000;
 
   color ambient;
   ambient.red = 50;
@@ -192,37 +581,75 @@ script()
 
   SYMTAB* sym;
 
-  for (f = 0; f < num_frames; f++) {
-    systems = new_stack();
-    tmp = new_matrix(4, 1000);
-    clear_screen(t);
-    clear_zbuffer(zb);
-
-    lights = 0;
-
-    sprintf(frame_name, "anim/%s_%03d.png", name, f);
-
-    vn = knobs[f];
-
-    while (vn) {
-      printf("\tknob: %s value:%lf\n", vn->name, vn->value);
-      set_value(lookup_symbol(vn->name), vn->value);
-      vn = vn->next;
+  transform = new_matrix(4, 4);
+  ident(transform);
+
+  refresh_textures();
+  profile_start(lastop);
+  writer_start();
+  t = writer_acquire();
+  cache_open();
+  if (opts.msaa)
+    msaa_start(opts.msaa);
+  rt_start();
+  if (opts.shadows)
+    shadow_start();
+
+  for (f = start; f <= end; f++) {
+    /* the stream's reader went away, there is nowhere for frames to go */
+    if (writer_failed())
+      break;
+    frame_file(frame_name, f);
+
+    row = knobs->values + (f - knobs->start) * knobs->count;
+
+    perf_stage(STAGE_KNOBS);
+    for (k = 0; k < knobs->count; k++) {
+      if (knobs->animated[k])
+        printf("\tknob: %s value:%lf\n", knobs->knobs[k]->name, row[k]);
+      set_value(knobs->knobs[k], row[k]);
     }
+    perf_stage(STAGE_OTHER);
 
     printf("\nFrame: %d of %d\n", f + 1, num_frames);
 
-    for (i = 0; i < lastop; i++) {
-      printf("%d: ", i);
+    key = cache_key(row, knobs->count);
+    if (cache_lookup(f, key)) {
+      server_event("frame %d cached %s\n", f, frame_name);
+      continue;
+    }
+    if (memory_recall(f, key, *t)) {
+      perf_stage(STAGE_ENCODE);
+      finish_frame(&t, f, frame_name, &checksum);
+      continue;
+    }
 
-      switch (op[i].opcode) {
+    /* everything a frame allocates comes from frame_arena, sized like the
+       frame before so it is not grown again */
+    systems = arena_stack(&frame_arena);
+    tmp = arena_matrix(&frame_arena, 4, tmp_cols);
+    uvs = arena_matrix(&frame_arena, UV_ROWS, uv_cols);
+    clear_screen(*t);
+    clear_zbuffer(zb);
+    if (msaa.samples)
+      msaa_clear();
+
+    lights = 0;
+    shading = SHADING_FLAT;
+    rt_clear();
+    if (shadows.enabled)
+      shadow_clear();
+
+    for (pc = 0; pc < lastinst; pc++) {
+      ins = &program[pc];
+      cmd = &op[ins->index];
+      shadows.dynamic = ins->dynamic;
+      if (opts.profile)
+        started = profile_clock();
+
+      switch (ins->opcode) {
         case LIGHT:
-          printf("Light: %s at: %6.2f %6.2f %6.2f",
-                 op[i].op.light.p->name,
-                 op[i].op.light.c[0],
-                 op[i].op.light.c[1],
-                 op[i].op.light.c[2]);
-          sym = lookup_symbol(op[i].op.light.p->name);
+          sym = cmd->op.light.p;
           if (lights < MAX_LIGHTS) {
             light[lights][LOCATION][0] = sym->s.l->l[0];
             light[lights][LOCATION][1] = sym->s.l->l[1];
@@ -232,272 +659,281 @@ script()
             light[lights][COLOR][GREEN] = sym->s.l->c[1];
             light[lights][COLOR][BLUE] = sym->s.l->c[2];
 
-            if (op[i].op.light.b) {
-              sym = lookup_symbol(op[i].op.light.b->name);
+            if (cmd->op.light.b) {
+              knob_value = cmd->op.light.b->s.value;
 
-              light[lights][COLOR][RED] *= sym->s.value;
-              light[lights][COLOR][GREEN] *= sym->s.value;
-              light[lights][COLOR][BLUE] *= sym->s.value;
+              light[lights][COLOR][RED] *= knob_value;
+              light[lights][COLOR][GREEN] *= knob_value;
+              light[lights][COLOR][BLUE] *= knob_value;
             }
             lights += 1;
           }
           break;
-        case AMBIENT:
-          printf("Ambient: %6.2f %6.2f %6.2f",
-                 op[i].op.ambient.c[0],
-                 op[i].op.ambient.c[1],
-                 op[i].op.ambient.c[2]);
-          break;
-        case CONSTANTS:
-          printf("Constants: %s", op[i].op.constants.p->name);
-          break;
-        case SAVE_COORDS:
-          printf("Save Coords: %s", op[i].op.save_coordinate_system.p->name);
-          break;
-        case CAMERA:
-          printf("Camera: eye: %6.2f %6.2f %6.2f\taim: %6.2f %6.2f %6.2f",
-                 op[i].op.camera.eye[0],
-                 op[i].op.camera.eye[1],
-                 op[i].op.camera.eye[2],
-                 op[i].op.camera.aim[0],
-                 op[i].op.camera.aim[1],
-                 op[i].op.camera.aim[2]);
-          break;
         case SPHERE:
-          printf("Sphere: %6.2f %6.2f %6.2f r=%6.2f",
-                 op[i].op.sphere.d[0],
-                 op[i].op.sphere.d[1],
-                 op[i].op.sphere.d[2],
-                 op[i].op.sphere.r);
-          if (op[i].op.sphere.constants != NULL) {
-            printf("\tconstants: %s", op[i].op.sphere.constants->name);
-            reflect = lookup_symbol(op[i].op.sphere.constants->name)->s.c;
-          }
-          if (op[i].op.sphere.cs != NULL) {
-            printf("\tcs: %s", op[i].op.sphere.cs->name);
-          }
-          add_sphere(tmp,
-                     op[i].op.sphere.d[0],
-                     op[i].op.sphere.d[1],
-                     op[i].op.sphere.d[2],
-                     op[i].op.sphere.r,
-                     step_3d);
-          matrix_mult(peek(systems), tmp);
-          draw_polygons(tmp, t, zb, view, lights, light, ambient, reflect);
+          if (cmd->op.sphere.constants != NULL)
+            reflect = cmd->op.sphere.constants->s.c;
+          perf_stage(STAGE_GEOMETRY);
+          sphere_polygons(tmp,
+                          cmd->op.sphere.d[0],
+                          cmd->op.sphere.d[1],
+                          cmd->op.sphere.d[2],
+                          cmd->op.sphere.r,
+                          step_3d);
+          perf_stage(STAGE_TRANSFORM);
+          matrix_mult(draw_system(cmd->op.sphere.cs, systems), tmp);
+          if (shading == SHADING_WIREFRAME)
+            draw_wireframe(tmp, *t, zb, g);
+          else if (shading == SHADING_RAYTRACE)
+            rt_add(tmp, lights, reflect);
+          else
+            draw_polygons(
+              tmp, *t, zb, view, lights, light, ambient, reflect, NULL);
+          perf_stage(STAGE_OTHER);
           tmp->lastcol = 0;
           reflect = &white;
           break;
         case TORUS:
-          printf("Torus: %6.2f %6.2f %6.2f r0=%6.2f r1=%6.2f",
-                 op[i].op.torus.d[0],
-                 op[i].op.torus.d[1],
-                 op[i].op.torus.d[2],
-                 op[i].op.torus.r0,
-                 op[i].op.torus.r1);
-          if (op[i].op.torus.constants != NULL) {
-            printf("\tconstants: %s", op[i].op.torus.constants->name);
-            reflect = lookup_symbol(op[i].op.sphere.constants->name)->s.c;
-          }
-          if (op[i].op.torus.cs != NULL) {
-            printf("\tcs: %s", op[i].op.torus.cs->name);
-          }
-          add_torus(tmp,
-                    op[i].op.torus.d[0],
-                    op[i].op.torus.d[1],
-                    op[i].op.torus.d[2],
-                    op[i].op.torus.r0,
-                    op[i].op.torus.r1,
-                    step_3d);
-          matrix_mult(peek(systems), tmp);
-          draw_polygons(tmp, t, zb, view, lights, light, ambient, reflect);
+          if (cmd->op.torus.constants != NULL)
+            reflect = cmd->op.torus.constants->s.c;
+          perf_stage(STAGE_GEOMETRY);
+          torus_polygons(tmp,
+                         cmd->op.torus.d[0],
+                         cmd->op.torus.d[1],
+                         cmd->op.torus.d[2],
+                         cmd->op.torus.r0,
+                         cmd->op.torus.r1,
+                         step_3d);
+          perf_stage(STAGE_TRANSFORM);
+          matrix_mult(draw_system(cmd->op.torus.cs, systems), tmp);
+          if (shading == SHADING_WIREFRAME)
+            draw_wireframe(tmp, *t, zb, g);
+          else if (shading == SHADING_RAYTRACE)
+            rt_add(tmp, lights, reflect);
+          else
+            draw_polygons(
+              tmp, *t, zb, view, lights, light, ambient, reflect, NULL);
+          perf_stage(STAGE_OTHER);
           tmp->lastcol = 0;
           reflect = &white;
           break;
         case BOX:
-          printf("Box: d0: %6.2f %6.2f %6.2f d1: %6.2f %6.2f %6.2f",
-                 op[i].op.box.d0[0],
-                 op[i].op.box.d0[1],
-                 op[i].op.box.d0[2],
-                 op[i].op.box.d1[0],
-                 op[i].op.box.d1[1],
-                 op[i].op.box.d1[2]);
-          if (op[i].op.box.constants != NULL) {
-            printf("\tconstants: %s", op[i].op.box.constants->name);
-            reflect = lookup_symbol(op[i].op.sphere.constants->name)->s.c;
-          }
-          if (op[i].op.box.cs != NULL) {
-            printf("\tcs: %s", op[i].op.box.cs->name);
-          }
+          if (cmd->op.box.constants != NULL)
+            reflect = cmd->op.box.constants->s.c;
+          perf_stage(STAGE_GEOMETRY);
           add_box(tmp,
-                  op[i].op.box.d0[0],
-                  op[i].op.box.d0[1],
-                  op[i].op.box.d0[2],
-                  op[i].op.box.d1[0],
-                  op[i].op.box.d1[1],
-                  op[i].op.box.d1[2]);
-          matrix_mult(peek(systems), tmp);
-          draw_polygons(tmp, t, zb, view, lights, light, ambient, reflect);
+                  cmd->op.box.d0[0],
+                  cmd->op.box.d0[1],
+                  cmd->op.box.d0[2],
+                  cmd->op.box.d1[0],
+                  cmd->op.box.d1[1],
+                  cmd->op.box.d1[2]);
+          perf_stage(STAGE_TRANSFORM);
+          matrix_mult(draw_system(cmd->op.box.cs, systems), tmp);
+          if (shading == SHADING_WIREFRAME)
+            draw_wireframe(tmp, *t, zb, g);
+          else if (shading == SHADING_RAYTRACE)
+            rt_add(tmp, lights, reflect);
+          else
+            draw_polygons(
+              tmp, *t, zb, view, lights, light, ambient, reflect, NULL);
+          perf_stage(STAGE_OTHER);
           tmp->lastcol = 0;
           reflect = &white;
           break;
         case LINE:
-          printf("Line: from: %6.2f %6.2f %6.2f to: %6.2f %6.2f %6.2f",
-                 op[i].op.line.p0[0],
-                 op[i].op.line.p0[1],
-                 op[i].op.line.p0[2],
-                 op[i].op.line.p1[0],
-                 op[i].op.line.p1[1],
-                 op[i].op.line.p1[2]);
-          if (op[i].op.line.constants != NULL) {
-            printf("\n\tConstants: %s", op[i].op.line.constants->name);
-          }
-          if (op[i].op.line.cs0 != NULL) {
-            printf("\n\tCS0: %s", op[i].op.line.cs0->name);
-          }
-          if (op[i].op.line.cs1 != NULL) {
-            printf("\n\tCS1: %s", op[i].op.line.cs1->name);
-          }
+          perf_stage(STAGE_GEOMETRY);
           add_edge(tmp,
-                   op[i].op.line.p0[0],
-                   op[i].op.line.p0[1],
-                   op[i].op.line.p0[2],
-                   op[i].op.line.p1[0],
-                   op[i].op.line.p1[1],
-                   op[i].op.line.p1[2]);
-          matrix_mult(peek(systems), tmp);
-          draw_lines(tmp, t, zb, g);
+                   cmd->op.line.p0[0],
+                   cmd->op.line.p0[1],
+                   cmd->op.line.p0[2],
+                   cmd->op.line.p1[0],
+                   cmd->op.line.p1[1],
+                   cmd->op.line.p1[2]);
+          perf_stage(STAGE_TRANSFORM);
+          if (cmd->op.line.cs1 == cmd->op.line.cs0)
+            matrix_mult(draw_system(cmd->op.line.cs0, systems), tmp);
+          else
+            transform_ends(tmp,
+                           draw_system(cmd->op.line.cs0, systems),
+                           draw_system(cmd->op.line.cs1, systems));
+          perf_stage(STAGE_RASTER);
+          draw_lines(tmp, *t, zb, g);
+          perf_stage(STAGE_OTHER);
           tmp->lastcol = 0;
           break;
         case MESH:
-          printf("Mesh: filename: %s", op[i].op.mesh.name);
-          if (op[i].op.mesh.constants != NULL) {
-            reflect = lookup_symbol(op[i].op.mesh.constants->name)->s.c;
-          }
-          obj_parser(tmp, op[i].op.mesh.name);
-          matrix_mult(peek(systems), tmp);
-          draw_polygons(tmp, t, zb, view, lights, light, ambient, reflect);
+          if (cmd->op.mesh.constants != NULL)
+            reflect = cmd->op.mesh.constants->s.c;
+          perf_stage(STAGE_GEOMETRY);
+          mesh_polygons(tmp, uvs, cmd->op.mesh.name);
+          perf_stage(STAGE_TRANSFORM);
+          matrix_mult(draw_system(cmd->op.mesh.cs, systems), tmp);
+          if (shading == SHADING_WIREFRAME)
+            draw_wireframe(tmp, *t, zb, g);
+          else if (shading == SHADING_RAYTRACE)
+            rt_add(tmp, lights, reflect);
+          else
+            draw_polygons(
+              tmp, *t, zb, view, lights, light, ambient, reflect, uvs);
+          perf_stage(STAGE_OTHER);
           tmp->lastcol = 0;
+          uvs->lastcol = 0;
           reflect = &white;
           break;
-        case SET:
-          printf(
-            "Set: %s %6.2f", op[i].op.set.p->name, op[i].op.set.p->s.value);
+        case TEXTURE:
+          perf_stage(STAGE_GEOMETRY);
+          add_texture_quad(tmp,
+                           uvs,
+                           cmd->op.texture.d0,
+                           cmd->op.texture.d1,
+                           cmd->op.texture.d2,
+                           cmd->op.texture.d3,
+                           load_texture(cmd->op.texture.p->name));
+          perf_stage(STAGE_TRANSFORM);
+          matrix_mult(draw_system(cmd->op.texture.cs, systems), tmp);
+          if (shading == SHADING_WIREFRAME)
+            draw_wireframe(tmp, *t, zb, g);
+          else if (shading == SHADING_RAYTRACE)
+            rt_add(tmp, lights, reflect);
+          else
+            draw_polygons(
+              tmp, *t, zb, view, lights, light, ambient, reflect, uvs);
+          perf_stage(STAGE_OTHER);
+          tmp->lastcol = 0;
+          uvs->lastcol = 0;
+          break;
+        case SAVE_COORDS:
+          copy_matrix(ins->m != NULL ? ins->m : peek(systems),
+                      cmd->op.save_coordinate_system.p->s.m);
+          break;
+        case TRANSFORM:
+          copy_matrix(ins->m, transform);
+          matrix_mult(peek(systems), transform);
+          copy_matrix(transform, peek(systems));
           break;
         case MOVE:
-          xval = op[i].op.move.d[0];
-          yval = op[i].op.move.d[1];
-          zval = op[i].op.move.d[2];
-          printf("Move: %6.2f %6.2f %6.2f", xval, yval, zval);
-          if (op[i].op.move.p != NULL) {
-            printf("\tknob: %s", op[i].op.move.p->name);
-            knob_value = lookup_symbol(op[i].op.move.p->name)->s.value;
-            xval *= knob_value;
-            yval *= knob_value;
-            zval *= knob_value;
-          }
-          tmp = make_translate(xval, yval, zval);
-          matrix_mult(peek(systems), tmp);
-          copy_matrix(tmp, peek(systems));
-          tmp->lastcol = 0;
+          knob_value = cmd->op.move.p->s.value;
+          set_translate(transform,
+                        cmd->op.move.d[0] * knob_value,
+                        cmd->op.move.d[1] * knob_value,
+                        cmd->op.move.d[2] * knob_value);
+          matrix_mult(peek(systems), transform);
+          copy_matrix(transform, peek(systems));
           break;
         case SCALE:
-          xval = op[i].op.scale.d[0];
-          yval = op[i].op.scale.d[1];
-          zval = op[i].op.scale.d[2];
-          printf("Scale: %6.2f %6.2f %6.2f", xval, yval, zval);
-          if (op[i].op.scale.p != NULL) {
-            printf("\tknob: %s", op[i].op.scale.p->name);
-            knob_value = lookup_symbol(op[i].op.scale.p->name)->s.value;
-            xval *= knob_value;
-            yval *= knob_value;
-            zval *= knob_value;
-          }
-          tmp = make_scale(xval, yval, zval);
-          matrix_mult(peek(systems), tmp);
-          copy_matrix(tmp, peek(systems));
-          tmp->lastcol = 0;
+          knob_value = cmd->op.scale.p->s.value;
+          set_scale(transform,
+                    cmd->op.scale.d[0] * knob_value,
+                    cmd->op.scale.d[1] * knob_value,
+                    cmd->op.scale.d[2] * knob_value);
+          matrix_mult(peek(systems), transform);
+          copy_matrix(transform, peek(systems));
           break;
         case ROTATE:
-          printf("Rotate: axis: %6.2f degrees: %6.2f",
-                 op[i].op.rotate.axis,
-                 op[i].op.rotate.degrees);
-          theta = op[i].op.rotate.degrees * (M_PI / 180);
-          if (op[i].op.rotate.p != NULL) {
-            printf("\tknob: %s", op[i].op.rotate.p->name);
-            knob_value = lookup_symbol(op[i].op.rotate.p->name)->s.value;
-            theta *= knob_value;
-          }
-
-          if (op[i].op.rotate.axis == 0)
-            tmp = make_rotX(theta);
-          else if (op[i].op.rotate.axis == 1)
-            tmp = make_rotY(theta);
+          knob_value = cmd->op.rotate.p->s.value;
+          theta = cmd->op.rotate.degrees * (M_PI / 180) * knob_value;
+          if (cmd->op.rotate.axis == 0)
+            set_rotX(transform, theta);
+          else if (cmd->op.rotate.axis == 1)
+            set_rotY(transform, theta);
           else
-            tmp = make_rotZ(theta);
-
-          matrix_mult(peek(systems), tmp);
-          copy_matrix(tmp, peek(systems));
-          tmp->lastcol = 0;
-          break;
-        case BASENAME:
-          printf("Basename: %s", name);
-          break;
-        case SAVE_KNOBS:
-          printf("Save knobs: %s", op[i].op.save_knobs.p->name);
-          break;
-        case TWEEN:
-          printf("Tween: %4.0f %4.0f, %s %s",
-                 op[i].op.tween.start_frame,
-                 op[i].op.tween.end_frame,
-                 op[i].op.tween.knob_list0->name,
-                 op[i].op.tween.knob_list1->name);
+            set_rotZ(transform, theta);
+          matrix_mult(peek(systems), transform);
+          copy_matrix(transform, peek(systems));
           break;
-        case FRAMES:
-          printf("Num frames: %4.0f", op[i].op.frames.num_frames);
-          break;
-        case VARY:
-          printf("Vary: %4.0f %4.0f, %4.0f %4.0f",
-                 op[i].op.vary.start_frame,
-                 op[i].op.vary.end_frame,
-                 op[i].op.vary.start_val,
-                 op[i].op.vary.end_val);
+        case SHADING:
+          shading = shading_mode(cmd->op.shading.p->name);
           break;
         case PUSH:
-          printf("Push");
           push(systems);
           break;
         case POP:
-          printf("Pop");
           pop(systems);
           break;
-        case GENERATE_RAYFILES:
-          printf("Generate Ray Files");
-          break;
         case SAVE:
-          printf("Save: %s", op[i].op.save.p->name);
-          save_extension(t, op[i].op.save.p->name);
-          break;
-        case SHADING:
-          printf("Shading: %s", op[i].op.shading.p->name);
-          break;
-        case SETKNOBS:
-          printf("Setknobs: %f", op[i].op.setknobs.value);
-          break;
-        case FOCAL:
-          printf("Focal: %f", op[i].op.focal.value);
+          rt_render(*t, zb, view, ambient, light);
+          if (shadows.enabled)
+            shadow_resolve(*t, zb, view, ambient, light);
+          perf_stage(STAGE_ENCODE);
+          if (msaa.samples)
+            msaa_resolve(*t, zb);
+          if (!opts.headless) {
+            copy = writer_acquire();
+            memcpy(*copy, *t, sizeof(screen));
+            writer_submit(copy, WRITER_SAVE, cmd->op.save.p->name, -1);
+          }
+          perf_stage(STAGE_OTHER);
           break;
         case DISPLAY:
-          printf("Display");
-          display(t);
+          rt_render(*t, zb, view, ambient, light);
+          if (shadows.enabled)
+            shadow_resolve(*t, zb, view, ambient, light);
+          perf_stage(STAGE_ENCODE);
+          if (msaa.samples)
+            msaa_resolve(*t, zb);
+          if (!opts.headless && !opts.preview) {
+            copy = writer_acquire();
+            memcpy(*copy, *t, sizeof(screen));
+            writer_submit(copy, WRITER_DISPLAY, NULL, -1);
+          }
+          perf_stage(STAGE_OTHER);
           break;
       }
-      save_extension(t, frame_name);
-      printf("\n");
+      if (opts.profile)
+        profile_op(ins->opcode, ins->index, profile_clock() - started);
     }
 
-    free_stack(systems);
-    free_matrix(tmp);
+    rt_render(*t, zb, view, ambient, light);
+    if (shadows.enabled)
+      shadow_resolve(*t, zb, view, ambient, light);
+    perf_stage(STAGE_ENCODE);
+    if (msaa.samples)
+      msaa_resolve(*t, zb);
+    memory_store(f, key, *t);
+    finish_frame(&t, f, frame_name, &checksum);
+
+    tmp_cols = tmp->cols;
+    uv_cols = uvs->cols;
+    arena_reset(&frame_arena);
+  }
+  writer_flush();
+  stopped = writer_failed();
+  writer_stop();
+  cache_close();
+  if (msaa.samples)
+    msaa_stop();
+  rt_stop();
+  shadow_stop();
+  free_matrix(transform);
+  arena_free(&frame_arena);
+  free_program();
+  free_knobs(knobs);
+
+  profile_stop(end - start + 1);
+  perf_report();
+  if (opts.profile)
+    print_profile();
+  if (opts.profile_json)
+    save_profile_json(opts.profile_json);
+  if (opts.bench)
+    printf("bench: %s frames=%d ms/frame=%.3f tris/s=%.0f px/s=%.0f "
+           "checksum=%016llx\n",
+           opts.script,
+           prof.frames,
+           prof.total * 1000 / prof.frames,
+           prof.triangles / prof.total,
+           prof.pixels / prof.total,
+           checksum);
+
+  if (num_frames > 1 && !opts.headless && !opts.stream) {
+    if (start > 0 || end < num_frames - 1)
+      printf("Rendered frames %d to %d of %d, run with --assemble once every "
+             "shard is done\n",
+             start,
+             end,
+             num_frames);
+    else
+      make_animation(name);
   }
-  if (num_frames > 1)
-    make_animation(name);
+  return !stopped;
 }
@@ -0,0 +1,281 @@
+/*
+--server: a long running mdl that renders scripts sent to it over a Unix
+domain socket, so a batch of small renders pays for process startup and
+for parsing its meshes once instead of once per script. Meshes,
+tessellations and textures stay loaded from one job to the next (see
+meshcache.c).
+
+A client connects and sends one job: a line of options, written like the
+command line and ending with a name for the job, then the text of the
+script, then shuts down its side of the connection. Files named in the
+script are found from the directory the server was started in. Jobs are
+run one at a time, in the order they connect. While a job runs, the server
+writes a line back for every event:
+
+  frame N saved FILE      the image of animation frame N is on disk
+  frame N cached FILE     frame N was already up to date in anim/
+  frame N rendered [SUM]  frame N is done and has no file of its own
+                          (SUM is the running checksum under --headless)
+  saved FILE              a save command wrote FILE
+  error MESSAGE           the job could not be run
+  done                    the job is over and every file is written
+
+A script that cannot be run, such as one with --frames past its end, ends
+its job with an error rather than the server. A client that has not sent its
+whole job within SERVER_TIMEOUT seconds gets an error, so it does not hold
+up the jobs queued behind it. The convert processes
+that make_animation starts are reaped between jobs.
+
+For example:
+
+  (echo "--format ppm cart"; cat scripts/cart.mdl) |
+    socat - UNIX-CONNECT:/tmp/mdl.sock
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "meshcache.h"
+#include "options.h"
+#include "parser.h"
+#include "server.h"
+
+struct render_server server;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+server_event(char* format, ...)
+{
+  /*
+  Send a line to the client of the running job, if there is one. Called
+  from the writer thread as well as the interpreter. A client that has
+  gone away gets nothing more, but the job still runs to the end.
+
+  @param: char* format
+  @param: ...
+
+  @return: void
+  */
+  char line[512];
+  va_list args;
+  int n;
+
+  if (!server.connected)
+    return;
+
+  va_start(args, format);
+  n = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (n >= (int)sizeof(line))
+    n = sizeof(line) - 1;
+
+  pthread_mutex_lock(&lock);
+  if (server.connected && write(server.client, line, n) != n)
+    server.connected = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+static char*
+read_job(int client)
+{
+  /*
+  Read everything the client sends, up to the end of its side of the
+  connection, into a string. Returns NULL if that takes more than
+  SERVER_TIMEOUT seconds.
+
+  @param: int client
+
+  @return: char*
+  */
+  long size = 0, capacity = 4096;
+  char* job = (char*)malloc(capacity);
+  long n;
+  struct timeval now, deadline, timeout;
+
+  gettimeofday(&deadline, NULL);
+  deadline.tv_sec += SERVER_TIMEOUT;
+  while (1) {
+    /* each read may only wait for what is left of the time */
+    gettimeofday(&now, NULL);
+    timersub(&deadline, &now, &timeout);
+    if (timeout.tv_sec < 0 || (timeout.tv_sec == 0 && timeout.tv_usec == 0)) {
+      free(job);
+      return NULL;
+    }
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    n = read(client, job + size, capacity - size - 1);
+    if (n == 0)
+      break;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        free(job);
+        return NULL;
+      }
+      break;
+    }
+    size += n;
+    if (size == capacity - 1) {
+      capacity *= 2;
+      job = (char*)realloc(job, capacity);
+    }
+  }
+  job[size] = '\0';
+  return job;
+}
+
+static int
+job_options(char* line)
+{
+  /*
+  Read the options of a job from its first line into opts. Returns 0 if
+  they are not valid for a job.
+
+  @param: char* line
+
+  @return: int
+  */
+  char* argv[SERVER_ARGS];
+  int argc = 0;
+  char* word;
+
+  argv[argc++] = "mdl";
+  for (word = strtok(line, " \t\r"); word && argc < SERVER_ARGS - 1;
+       word = strtok(NULL, " \t\r"))
+    argv[argc++] = word;
+  argv[argc] = NULL;
+
+  return read_options(argc, argv) && opts.script_count == 1 &&
+         opts.jobs == 1 && !opts.server && !opts.watch && !opts.stream &&
+         !opts.preview;
+}
+
+static void
+run_job(int client, struct options* base)
+{
+  /*
+  Read a job from client, render it and report back, leaving the options
+  the way the server was started.
+
+  @param: int client
+  @param: struct options* base
+
+  @return: void
+  */
+  char* job = read_job(client);
+  char* text = job ? strchr(job, '\n') : NULL;
+  FILE* f;
+
+  server.client = client;
+  server.connected = 1;
+
+  if (job == NULL) {
+    printf("Job %d: timed out\n", server.jobs);
+    server_event("error timed out waiting for the job\n");
+  } else if (text == NULL) {
+    server_event("error no script after the options\n");
+  } else {
+    *text++ = '\0';
+    printf("Job %d: %s\n", server.jobs, job);
+    if (!job_options(job)) {
+      server_event("error bad options\n");
+    } else {
+      /* the hardware counters were opened for the server */
+      opts.perf = base->perf;
+      reset_parser();
+      f = fmemopen(text, strlen(text), "r");
+      if (!parse_script(f))
+        server_event("error syntax error\n");
+      else
+        script();
+      fclose(f);
+      mesh_sweep(SERVER_KEEP);
+    }
+  }
+
+  server_event("done\n");
+  server.connected = 0;
+  opts = *base;
+  free(job);
+}
+
+void
+serve(char* path)
+{
+  /*
+  Listen on the Unix socket path and run the jobs sent to it, forever. An
+  old socket at path is replaced, anything else there is left alone.
+
+  @param: char* path
+
+  @return: void
+  */
+  struct sockaddr_un address;
+  struct options base = opts;
+  struct stat st;
+  int client;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    printf("Error: socket path %s is too long\n", path);
+    exit(1);
+  }
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      printf("Error: %s exists and is not a socket\n", path);
+      exit(1);
+    }
+    unlink(path);
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  server.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (server.listener < 0 ||
+      bind(server.listener, (struct sockaddr*)&address, sizeof(address)) ||
+      listen(server.listener, SERVER_BACKLOG)) {
+    perror("Error: could not listen on the socket");
+    exit(1);
+  }
+
+  /* a client that hangs up must not take the server with it */
+  signal(SIGPIPE, SIG_IGN);
+  server.serving = 1;
+  printf("Listening on %s\n", path);
+  fflush(stdout);
+
+  while (1) {
+    client = accept(server.listener, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Error: accept");
+      exit(1);
+    }
+    /* keep it from the convert and display processes a job starts */
+    fcntl(client, F_SETFD, FD_CLOEXEC);
+    server.jobs++;
+    run_job(client, &base);
+    close(client);
+    fflush(stdout);
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+      ;
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_BACKLOG 16
+#define SERVER_ARGS 32
+/* meshes a job has not drawn are kept for this many more jobs */
+#define SERVER_KEEP 64
+/* seconds a client has to send its whole job */
+#define SERVER_TIMEOUT 10
+
+struct render_server
+{
+  /* 1 once serve has started, so script errors end the job, not mdl */
+  int serving;
+  int listener;
+  /* the client whose job is running, if connected */
+  int client;
+  int connected;
+  int jobs;
+};
+
+extern struct render_server server;
+
+void
+server_event(char*, ...);
+
+void
+serve(char*);
+
+#endif
@@ -0,0 +1,398 @@
+/*
+Shadow mapping for --shadows. Lights are directional, so each light gets an
+orthographic depth map looking along its direction, rendered with
+scanline_convert like the frame itself.
+
+Polygons are shaded after the fact. draw_polygons hands every triangle to
+shadow_triangle, which keeps it in a table and rasterizes the ones facing
+the viewer into a buffer of triangle numbers instead of colors. When the
+frame is saved, shadow_resolve renders the maps from the table. Then, for
+every pixel, it finds the point on the triangle there, looks it up in each
+light's map, and lights it with only the lights that reach it.
+
+Geometry that no knob moves (see the dynamic flag set by compile) comes
+out the same in every frame, so its part of each map is kept from one
+frame to the next. It is only rendered again when a light turns, the
+region the map covers changes, or the amount of static geometry changes.
+Dynamic geometry is drawn over a copy of it every frame.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "display.h"
+#include "draw.h"
+#include "fixed.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "ml6.h"
+#include "options.h"
+#include "shadow.h"
+
+struct shadow_buffer shadows;
+
+static double
+dot(double* a, double* b)
+{
+  /*
+  Dot product that leaves its arguments alone.
+
+  @param: double* a
+  @param: double* b
+
+  @return: double
+  */
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void
+light_basis(double* dir, double* u, double* v, double* w)
+{
+  /*
+  Make an orthonormal basis with w along dir, pointing at the light.
+
+  @param: double* dir
+  @param: double* u
+  @param: double* v
+  @param: double* w
+
+  @return: void
+  */
+  double up[3] = { 0, 1, 0 };
+
+  memcpy(w, dir, 3 * sizeof(double));
+  normalize(w);
+  if (fabs(w[1]) > 0.9) {
+    up[0] = 1;
+    up[1] = 0;
+  }
+  u[0] = up[1] * w[2] - up[2] * w[1];
+  u[1] = up[2] * w[0] - up[0] * w[2];
+  u[2] = up[0] * w[1] - up[1] * w[0];
+  normalize(u);
+  v[0] = w[1] * u[2] - w[2] * u[1];
+  v[1] = w[2] * u[0] - w[0] * u[2];
+  v[2] = w[0] * u[1] - w[1] * u[0];
+}
+
+static void
+map_triangle(struct shadow_map* map,
+             depth_t (*depth)[YRES],
+             struct shadow_triangle* tri)
+{
+  /*
+  Rasterize a triangle into one of a light's maps. Map x and y run along u
+  and v, and z along w, so that nearer to the light is larger, as in the
+  zbuffer.
+
+  @param: struct shadow_map* map
+  @param: depth_t (*depth)[YRES]
+  @param: struct shadow_triangle* tri
+
+  @return: void
+  */
+  struct matrix* points = shadows.points;
+  color c;
+  int k;
+
+  c.red = c.green = c.blue = 0;
+  for (k = 0; k < 3; k++) {
+    points->m[0][k] = (dot(tri->p[k], map->u) - map->low[0]) * map->scale[0];
+    points->m[1][k] = (dot(tri->p[k], map->v) - map->low[1]) * map->scale[1];
+    points->m[2][k] = dot(tri->p[k], map->w);
+    points->m[3][k] = 1;
+  }
+  scanline_convert(points, 0, shadows.scratch, depth, c);
+}
+
+static void
+prepare_map(struct shadow_map* map, double* dir)
+{
+  /*
+  Bring a light's maps up to date with this frame: work out the region of
+  the map from all of the triangles, render the static ones if what was
+  kept no longer fits, and add the dynamic ones.
+
+  @param: struct shadow_map* map
+  @param: double* dir
+
+  @return: void
+  */
+  double u[3], v[3], w[3], low[2], high[2], scale[2];
+  double a, b;
+  int i, k, dynamic = 0;
+
+  light_basis(dir, u, v, w);
+  low[0] = low[1] = HUGE_VAL;
+  high[0] = high[1] = -HUGE_VAL;
+  for (i = 0; i < shadows.count; i++) {
+    dynamic |= shadows.triangles[i].dynamic;
+    for (k = 0; k < 3; k++) {
+      a = dot(shadows.triangles[i].p[k], u);
+      b = dot(shadows.triangles[i].p[k], v);
+      low[0] = a < low[0] ? a : low[0];
+      high[0] = a > high[0] ? a : high[0];
+      low[1] = b < low[1] ? b : low[1];
+      high[1] = b > high[1] ? b : high[1];
+    }
+  }
+  for (k = 0; k < 2; k++) {
+    low[k] = floor(low[k] / SHADOW_SNAP) * SHADOW_SNAP;
+    high[k] = ceil(high[k] / SHADOW_SNAP) * SHADOW_SNAP;
+    if (high[k] <= low[k])
+      high[k] = low[k] + SHADOW_SNAP;
+  }
+  scale[0] = (XRES - 1) / (high[0] - low[0]);
+  scale[1] = (YRES - 1) / (high[1] - low[1]);
+
+  if (!map->fixed) {
+    map->fixed = (depth_t(*)[YRES])malloc(sizeof(zbuffer));
+    map->depth = (depth_t(*)[YRES])malloc(sizeof(zbuffer));
+  }
+
+  if (!map->valid || memcmp(map->dir, dir, sizeof(map->dir)) ||
+      memcmp(map->low, low, sizeof(low)) ||
+      memcmp(map->scale, scale, sizeof(scale)) ||
+      map->fixed_count != shadows.fixed_count) {
+    memcpy(map->dir, dir, sizeof(map->dir));
+    memcpy(map->u, u, sizeof(u));
+    memcpy(map->v, v, sizeof(v));
+    memcpy(map->w, w, sizeof(w));
+    memcpy(map->low, low, sizeof(low));
+    memcpy(map->scale, scale, sizeof(scale));
+    clear_zbuffer(map->fixed);
+    for (i = 0; i < shadows.count; i++)
+      if (!shadows.triangles[i].dynamic)
+        map_triangle(map, map->fixed, &shadows.triangles[i]);
+    map->fixed_count = shadows.fixed_count;
+    map->valid = 1;
+    shadows.rendered++;
+  } else
+    shadows.reused++;
+
+  map->use = map->fixed;
+  if (dynamic) {
+    memcpy(map->depth, map->fixed, sizeof(zbuffer));
+    for (i = 0; i < shadows.count; i++)
+      if (shadows.triangles[i].dynamic)
+        map_triangle(map, map->depth, &shadows.triangles[i]);
+    map->use = map->depth;
+  }
+}
+
+static int
+in_shadow(struct shadow_map* map, struct shadow_triangle* tri, double* p)
+{
+  /*
+  Whether the light of map is blocked at point p on triangle tri. The bias
+  grows with the slope of the triangle as seen from the light.
+
+  @param: struct shadow_map* map
+  @param: struct shadow_triangle* tri
+  @param: double* p
+
+  @return: int
+  */
+  double x = (dot(p, map->u) - map->low[0]) * map->scale[0];
+  double y = (dot(p, map->v) - map->low[1]) * map->scale[1];
+  double texel = fmax(1 / map->scale[0], 1 / map->scale[1]);
+  double cosine = dot(tri->normal, map->w);
+  double slope, bias;
+  int col = (int)x;
+  int row = (int)y;
+
+  if (x < 0 || y < 0 || col >= XRES || row >= YRES)
+    return 0;
+
+  slope = sqrt(fmax(0, 1 - cosine * cosine)) / cosine;
+  slope = slope < SHADOW_MAX_SLOPE ? slope : SHADOW_MAX_SLOPE;
+  bias = texel * (SHADOW_BIAS + slope);
+  return DEPTH_TEST(DEPTH_ENCODE(dot(p, map->w) + bias),
+                    map->use[col][YRES - 1 - row]);
+}
+
+void
+shadow_start()
+{
+  /*
+  Allocate the buffers used with --shadows.
+
+  @param: No parameters
+
+  @return: void
+  */
+  memset(&shadows, 0, sizeof(shadows));
+  shadows.enabled = 1;
+  shadows.ids = (struct point_t(*)[YRES])malloc(sizeof(screen));
+  shadows.depths = (depth_t(*)[YRES])malloc(sizeof(zbuffer));
+  shadows.scratch = (struct point_t(*)[YRES])malloc(sizeof(screen));
+  shadows.points = new_matrix(4, 3);
+  shadows.points->lastcol = 3;
+}
+
+void
+shadow_clear()
+{
+  /*
+  Forget the triangles of the last frame. The static maps are kept.
+
+  @param: No parameters
+
+  @return: void
+  */
+  memset(shadows.ids, 0, sizeof(screen));
+  clear_zbuffer(shadows.depths);
+  shadows.count = 0;
+  shadows.fixed_count = 0;
+}
+
+void
+shadow_triangle(struct matrix* polygons,
+                int i,
+                double* normal,
+                int visible,
+                int lights,
+                struct constants* reflect,
+                color c)
+{
+  /*
+  Add triangle i of polygons to the frame. Every triangle casts shadows;
+  visible ones, lit with color c by the first lights lights, are also
+  drawn into the triangle number buffer.
+
+  @param: struct matrix* polygons
+  @param: int i
+  @param: double* normal
+  @param: int visible
+  @param: int lights
+  @param: struct constants* reflect
+  @param: color c
+
+  @return: void
+  */
+  struct shadow_triangle* tri;
+  color id;
+  int j, k;
+
+  if (shadows.count == shadows.capacity) {
+    shadows.capacity = shadows.capacity ? 2 * shadows.capacity : 1024;
+    shadows.triangles = (struct shadow_triangle*)realloc(
+      shadows.triangles, shadows.capacity * sizeof(struct shadow_triangle));
+  }
+  tri = &shadows.triangles[shadows.count++];
+  for (k = 0; k < 3; k++)
+    for (j = 0; j < 3; j++)
+      tri->p[k][j] = polygons->m[j][i + k];
+  memcpy(tri->normal, normal, sizeof(tri->normal));
+  normalize(tri->normal);
+  tri->lights = lights;
+  tri->dynamic = shadows.dynamic;
+  tri->reflect = reflect;
+  tri->c = c;
+  if (!tri->dynamic)
+    shadows.fixed_count++;
+
+  if (!visible)
+    return;
+  id.red = shadows.count;
+  id.green = id.blue = 0;
+  if (opts.raster == RASTER_FIXED)
+    fixed_triangle(polygons, i, shadows.ids, shadows.depths, id);
+  else
+    scanline_convert(polygons, i, shadows.ids, shadows.depths, id);
+}
+
+void
+shadow_resolve(screen s,
+               zbuffer zb,
+               double* view,
+               color ambient,
+               double light[MAX_LIGHTS][2][3])
+{
+  /*
+  Shade every pixel covered by a polygon into s, leaving out the lights
+  that are blocked there. Pixels where something was drawn into s directly
+  (lines) in front of the polygon keep it.
+
+  @param: screen s
+  @param: zbuffer zb
+  @param: double* view
+  @param: color ambient
+  @param: double light[MAX_LIGHTS][2][3]
+
+  @return: void
+  */
+  double visible[MAX_LIGHTS][2][3];
+  double normal[3], p[3];
+  struct shadow_triangle* tri;
+  int x, y, n, id, count;
+  int lights = 0;
+
+  for (n = 0; n < shadows.count; n++)
+    if (shadows.triangles[n].lights > lights)
+      lights = shadows.triangles[n].lights;
+  for (n = 0; n < lights; n++)
+    prepare_map(&shadows.maps[n], light[n][LOCATION]);
+
+  for (x = 0; x < XRES; x++) {
+    for (y = 0; y < YRES; y++) {
+      id = shadows.ids[x][y].red;
+      if (!id)
+        continue;
+      if (zb[x][y] != DEPTH_CLEAR &&
+          DEPTH_TEST(shadows.depths[x][y], zb[x][y]))
+        continue;
+      tri = &shadows.triangles[id - 1];
+
+      /* the point on the triangle's plane at this pixel */
+      p[0] = x;
+      p[1] = YRES - 1 - y;
+      p[2] = tri->p[0][2] - (tri->normal[0] * (p[0] - tri->p[0][0]) +
+                             tri->normal[1] * (p[1] - tri->p[0][1])) /
+                              tri->normal[2];
+
+      count = 0;
+      for (n = 0; n < tri->lights; n++) {
+        if (dot(tri->normal, shadows.maps[n].w) > 0 &&
+            in_shadow(&shadows.maps[n], tri, p))
+          continue;
+        memcpy(visible[count++], light[n], sizeof(visible[0]));
+      }
+      if (count == tri->lights) {
+        s[x][y] = tri->c;
+        continue;
+      }
+      memcpy(normal, tri->normal, sizeof(normal));
+      s[x][y] =
+        get_lighting(normal, view, ambient, count, visible, tri->reflect);
+    }
+  }
+}
+
+void
+shadow_stop()
+{
+  /*
+  Free the shadow buffers and maps.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int n;
+
+  if (!shadows.enabled)
+    return;
+  for (n = 0; n < MAX_LIGHTS; n++) {
+    free(shadows.maps[n].fixed);
+    free(shadows.maps[n].depth);
+  }
+  free(shadows.triangles);
+  free(shadows.ids);
+  free(shadows.depths);
+  free(shadows.scratch);
+  free_matrix(shadows.points);
+  memset(&shadows, 0, sizeof(shadows));
+}
@@ -0,0 +1,87 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+
+/* shadow map regions are rounded out to this many units, so small moves
+   of dynamic geometry keep the cached maps usable */
+#define SHADOW_SNAP 64.0
+/* depth bias, in shadow map texels */
+#define SHADOW_BIAS 1.5
+#define SHADOW_MAX_SLOPE 8.0
+
+struct shadow_triangle
+{
+  double p[3][3];
+  double normal[3];
+  int lights;
+  int dynamic;
+  struct constants* reflect;
+  color c;
+};
+
+struct shadow_map
+{
+  /* the light direction and region the maps were made for */
+  double dir[3];
+  double u[3], v[3], w[3];
+  double low[2], scale[2];
+  /* static geometry only, kept from frame to frame */
+  depth_t (*fixed)[YRES];
+  int fixed_count;
+  int valid;
+  /* the static map with this frame's dynamic geometry added */
+  depth_t (*depth)[YRES];
+  depth_t (*use)[YRES];
+};
+
+struct shadow_buffer
+{
+  int enabled;
+  /* set by the interpreter for the command being drawn */
+  int dynamic;
+
+  struct shadow_triangle* triangles;
+  int count, capacity;
+  int fixed_count;
+
+  /* triangle index + 1 in red, for the triangle in front at each pixel */
+  struct point_t (*ids)[YRES];
+  depth_t (*depths)[YRES];
+  struct point_t (*scratch)[YRES];
+  struct matrix* points;
+
+  struct shadow_map maps[MAX_LIGHTS];
+  long rendered, reused;
+};
+
+extern struct shadow_buffer shadows;
+
+void
+shadow_start();
+
+void
+shadow_clear();
+
+void
+shadow_triangle(struct matrix*,
+                int,
+                double*,
+                int,
+                int,
+                struct constants*,
+                color);
+
+void
+shadow_resolve(screen,
+               zbuffer,
+               double*,
+               color,
+               double light[MAX_LIGHTS][2][3]);
+
+void
+shadow_stop();
+
+#endif
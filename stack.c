@@ -1,5 +1,7 @@
 #include "stack.h"
+#include "arena.h"
 #include "matrix.h"
+#include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -26,6 +28,32 @@ new_stack()
   s->top = 0;
   s->data = m;
   s->data[s->top] = i;
+  s->arena = NULL;
+
+  return s;
+}
+
+struct stack*
+arena_stack(struct arena* a)
+{
+  /*
+  Creates a stack like new_stack, but allocated from a along with every
+  matrix pushed onto it, so it lasts until a is reset.
+
+  @param: struct arena* a
+
+  @return: struct stack*
+  */
+  struct stack* s;
+
+  s = (struct stack*)arena_alloc(a, sizeof(struct stack));
+  s->size = STACK_SIZE;
+  s->top = 0;
+  s->data =
+    (struct matrix**)arena_alloc(a, STACK_SIZE * sizeof(struct matrix*));
+  s->data[s->top] = arena_matrix(a, 4, 4);
+  ident(s->data[s->top]);
+  s->arena = a;
 
   return s;
 }
@@ -42,11 +70,22 @@ push(struct stack* s)
   @return: void
   */
   struct matrix* m;
-  m = new_matrix(4, 4);
+  struct matrix** data;
+
+  if (s->arena)
+    m = arena_matrix(s->arena, 4, 4);
+  else
+    m = new_matrix(4, 4);
 
   if (s->top == s->size - 1) {
-    s->data = (struct matrix**)realloc(
-      s->data, (s->size + STACK_SIZE) * sizeof(struct matrix*));
+    if (s->arena) {
+      data = (struct matrix**)arena_alloc(
+        s->arena, (s->size + STACK_SIZE) * sizeof(struct matrix*));
+      memcpy(data, s->data, s->size * sizeof(struct matrix*));
+      s->data = data;
+    } else
+      s->data = (struct matrix**)realloc(
+        s->data, (s->size + STACK_SIZE) * sizeof(struct matrix*));
     s->size = s->size + STACK_SIZE;
   }
 
@@ -87,7 +126,8 @@ void
 free_stack(struct stack* s)
 {
   /*
-  Deallocate all the memory used in the stack.
+  Deallocate all the memory used in the stack. A stack from arena_stack
+  goes when its arena is reset.
 
   @param: struct stack*
 
@@ -95,6 +135,8 @@ free_stack(struct stack* s)
   */
   int i;
 
+  if (s->arena)
+    return;
   for (i = 0; i <= s->top; i++) {
     free_matrix(s->data[i]);
   }
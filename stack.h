@@ -3,16 +3,23 @@
 
 #define STACK_SIZE 2
 
+struct arena;
+
 struct stack
 {
   int size;
   int top;
   struct matrix** data;
+  /* where its matrices come from, or NULL for malloc */
+  struct arena* arena;
 };
 
 struct stack*
 new_stack();
 
+struct stack*
+arena_stack(struct arena*);
+
 struct matrix*
 peek(struct stack*);
 
@@ -0,0 +1,166 @@
+/*
+Raw video output. Every frame is written to a file descriptor, usually
+stdout or a named pipe, as a YUV4MPEG2 stream or as bare rgb24 frames, so an
+encoder such as ffmpeg can read the animation without any intermediate
+images. Each frame goes out in a single large write. If a write fails, say
+because the reader went away, the stream is marked failed, later frames are
+dropped and the interpreter stops rendering at the next frame.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "ml6.h"
+#include "profile.h"
+#include "stream.h"
+
+struct stream out = { .fd = -1 };
+
+static int
+write_all(int fd, unsigned char* buffer, long size)
+{
+  /*
+  Write size bytes from buffer, going around again after the short writes
+  pipes are allowed to make. Returns 0, marking the stream failed, if the
+  write fails.
+
+  @param: int fd
+  @param: unsigned char* buffer
+  @param: long size
+
+  @return: int
+  */
+  long n;
+
+  while (size > 0) {
+    n = write(fd, buffer, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      printf("Error: could not write the video stream: %s\n", strerror(errno));
+      out.failed = 1;
+      return 0;
+    }
+    prof.bytes += n;
+    buffer += n;
+    size -= n;
+  }
+  return 1;
+}
+
+void
+stream_open(char* file, int format)
+{
+  /*
+  Open file for streaming, "-" being stdout, and write the stream header.
+  When the stream is stdout, everything the interpreter prints is sent to
+  stderr from here on so it does not end up in the video.
+
+  @param: char* file
+  @param: int format
+
+  @return: void
+  */
+  char header[64];
+
+  if (strcmp(file, "-") == 0) {
+    fflush(stdout);
+    out.fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  } else
+    out.fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (out.fd < 0) {
+    printf("Error: could not open %s: %s\n", file, strerror(errno));
+    exit(1);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  out.format = format;
+  out.frames = 0;
+  out.failed = 0;
+  out.rgb = (unsigned char*)malloc(XRES * YRES * 3);
+  out.frame = (unsigned char*)malloc(XRES * YRES * 3 + 6);
+
+  if (format == STREAM_Y4M) {
+    sprintf(header,
+            "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+            XRES,
+            YRES,
+            STREAM_FPS);
+    write_all(out.fd, (unsigned char*)header, strlen(header));
+  }
+}
+
+int
+stream_frame(screen s)
+{
+  /*
+  Append s to the stream. For Y4M the pixels are converted to limited range
+  BT.601 Y'CbCr 4:4:4 with the usual 8 bit integer approximation and laid
+  out as a FRAME marker followed by the Y, Cb and Cr planes. Returns 0,
+  writing nothing, once the stream has failed.
+
+  @param: screen s
+
+  @return: int
+  */
+  int i, r, g, b;
+  unsigned char* rgb = out.rgb;
+  unsigned char* y = out.frame + 6;
+  unsigned char* u = y + XRES * YRES;
+  unsigned char* v = u + XRES * YRES;
+
+  if (out.failed)
+    return 0;
+
+  pack_rgb24(s, out.rgb);
+
+  if (out.format == STREAM_RGB24) {
+    if (!write_all(out.fd, out.rgb, XRES * YRES * 3))
+      return 0;
+    out.frames++;
+    return 1;
+  }
+
+  memcpy(out.frame, "FRAME\n", 6);
+  for (i = 0; i < XRES * YRES; i++) {
+    r = rgb[0];
+    g = rgb[1];
+    b = rgb[2];
+    rgb += 3;
+    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+  if (!write_all(out.fd, out.frame, XRES * YRES * 3 + 6))
+    return 0;
+  out.frames++;
+  return 1;
+}
+
+void
+stream_close()
+{
+  /*
+  Close the stream and free its buffers.
+
+  @param: No parameters
+
+  @return: void
+  */
+  if (out.fd < 0)
+    return;
+
+  close(out.fd);
+  free(out.rgb);
+  free(out.frame);
+  printf("Streamed %d frames\n", out.frames);
+  out.fd = -1;
+}
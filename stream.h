@@ -0,0 +1,31 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "ml6.h"
+
+#define STREAM_Y4M 0
+#define STREAM_RGB24 1
+#define STREAM_FPS 60
+
+struct stream
+{
+  int fd;
+  int format;
+  int frames;
+  int failed;
+  unsigned char* rgb;
+  unsigned char* frame;
+};
+
+extern struct stream out;
+
+void
+stream_open(char*, int);
+
+int
+stream_frame(screen);
+
+void
+stream_close();
+
+#endif
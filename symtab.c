@@ -2,12 +2,59 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "intern.h"
 #include "matrix.h"
 #include "parser.h"
 #include "symtab.h"
 
-SYMTAB symtab[MAX_SYMBOLS];
+SYMTAB** symtab = NULL;
 int lastsym = 0;
+int symtab_failed = 0;
+
+static int maxsym = 0;
+/* open addressed hash of the symbols by name, twice the size of symtab */
+static SYMTAB** buckets = NULL;
+static int nbuckets = 0;
+
+static int
+grow_symtab()
+{
+  /*
+  Make room for one more symbol, doubling symtab and its hash when full.
+  Returns 0 if there is no memory for it.
+
+  @param: No parameters
+
+  @return: int
+  */
+  SYMTAB** list;
+  SYMTAB** table;
+  int size, i, j;
+
+  if (lastsym < maxsym)
+    return 1;
+
+  size = maxsym ? maxsym * 2 : SYM_CHUNK;
+  list = (SYMTAB**)realloc(symtab, size * sizeof(SYMTAB*));
+  if (list == NULL)
+    return 0;
+  symtab = list;
+  table = (SYMTAB**)calloc(2 * size, sizeof(SYMTAB*));
+  if (table == NULL)
+    return 0;
+  maxsym = size;
+
+  free(buckets);
+  buckets = table;
+  nbuckets = 2 * size;
+  for (i = 0; i < lastsym; i++) {
+    j = intern_hash(symtab[i]->name) & (nbuckets - 1);
+    while (buckets[j])
+      j = (j + 1) & (nbuckets - 1);
+    buckets[j] = symtab[i];
+  }
+  return 1;
+}
 
 void
 print_constants(struct constants* p)
@@ -59,27 +106,27 @@ print_symtab()
   */
   int i;
   for (i = 0; i < lastsym; i++) {
-    printf("Name: %s\n", symtab[i].name);
-    switch (symtab[i].type) {
+    printf("Name: %s\n", symtab[i]->name);
+    switch (symtab[i]->type) {
       case SYM_MATRIX:
         printf("Type: SYM_MATRIX\n");
-        print_matrix(symtab[i].s.m);
+        print_matrix(symtab[i]->s.m);
         break;
       case SYM_CONSTANTS:
         printf("Type: SYM_CONSTANTS\n");
-        print_constants(symtab[i].s.c);
+        print_constants(symtab[i]->s.c);
         break;
       case SYM_LIGHT:
         printf("Type: SYM_LIGHT\n");
-        print_light(symtab[i].s.l);
+        print_light(symtab[i]->s.l);
         break;
       case SYM_VALUE:
         printf("Type: SYM_VALUE\n");
-        printf("value: %6.2f\n", symtab[i].s.value);
+        printf("value: %6.2f\n", symtab[i]->s.value);
         break;
       case SYM_FILE:
         printf("Type: SYM_VALUE\n");
-        printf("Name: %s\n", symtab[i].name);
+        printf("Name: %s\n", symtab[i]->name);
     }
     printf("\n");
   }
@@ -89,7 +136,8 @@ SYMTAB*
 add_symbol(char* name, int type, void* data)
 {
   /*
-  Add a symbol.
+  Add a symbol. Returns NULL, and sets symtab_failed, if there is no
+  memory for it.
 
   @param: char* name
   @param: int type
@@ -98,21 +146,28 @@ add_symbol(char* name, int type, void* data)
   @return: SYMTAB*
   */
   SYMTAB* t;
+  int i;
 
-  t = (SYMTAB*)lookup_symbol(name);
-  if (t == NULL) {
-    if (lastsym >= MAX_SYMBOLS) {
-      return NULL;
-    }
-    t = (SYMTAB*)&(symtab[lastsym]);
-    lastsym++;
-  } else {
+  name = intern(name);
+  t = lookup_symbol(name);
+  if (t != NULL)
     return t;
-  }
 
-  t->name = (char*)malloc(strlen(name) + 1);
-  strcpy(t->name, name);
+  if (!grow_symtab() || (t = (SYMTAB*)calloc(1, sizeof(SYMTAB))) == NULL) {
+    printf("Error: out of memory after %d symbols\n", lastsym);
+    symtab_failed = 1;
+    return NULL;
+  }
+  t->name = name;
   t->type = type;
+  t->index = lastsym;
+  symtab[lastsym++] = t;
+
+  i = intern_hash(t->name) & (nbuckets - 1);
+  while (buckets[i])
+    i = (i + 1) & (nbuckets - 1);
+  buckets[i] = t;
+
   switch (type) {
     case SYM_CONSTANTS:
       t->s.c = (struct constants*)data;
@@ -129,26 +184,32 @@ add_symbol(char* name, int type, void* data)
     case SYM_FILE:
       break;
   }
-  return (SYMTAB*)&(symtab[lastsym - 1]);
+  return t;
 }
 
 SYMTAB*
 lookup_symbol(char* name)
 {
   /*
-  Look up a symbol.
+  Look up a symbol. name must be interned, like every name from the
+  lexer, since names are compared by pointer.
 
   @param: char* name
 
   @return: SYMTAB*
   */
   int i;
-  for (i = 0; i < lastsym; i++) {
-    if (!strcmp(name, symtab[i].name)) {
-      return (SYMTAB*)&(symtab[i]);
-    }
+
+  if (nbuckets == 0)
+    return NULL;
+
+  i = intern_hash(name) & (nbuckets - 1);
+  while (buckets[i]) {
+    if (name == buckets[i]->name)
+      return buckets[i];
+    i = (i + 1) & (nbuckets - 1);
   }
-  return (SYMTAB*)NULL;
+  return NULL;
 }
 
 void
@@ -164,3 +225,31 @@ set_value(SYMTAB* p, double value)
   */
   p->s.value = value;
 }
+
+void
+clear_symtab()
+{
+  /*
+  Remove every symbol, freeing the constants, lights and matrices they
+  hold, so another script can be parsed. symtab keeps its size.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  for (i = 0; i < lastsym; i++) {
+    if (symtab[i]->type == SYM_CONSTANTS)
+      free(symtab[i]->s.c);
+    else if (symtab[i]->type == SYM_LIGHT)
+      free(symtab[i]->s.l);
+    else if (symtab[i]->type == SYM_MATRIX)
+      free_matrix(symtab[i]->s.m);
+    free(symtab[i]);
+  }
+  if (buckets)
+    memset(buckets, 0, nbuckets * sizeof(SYMTAB*));
+  lastsym = 0;
+  symtab_failed = 0;
+}
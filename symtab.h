@@ -1,7 +1,8 @@
 #ifndef SYMTAB_H
 #define SYMTAB_H
 
-#define MAX_SYMBOLS 512
+/* symtab starts with room for SYM_CHUNK symbols and doubles when full */
+#define SYM_CHUNK 64
 #define SYM_MATRIX 1
 #define SYM_VALUE 2
 #define SYM_CONSTANTS 3
@@ -31,6 +32,8 @@ typedef struct
 {
   char* name;
   int type;
+  /* position in symtab, for tables indexed by symbol */
+  int index;
   union
   {
     struct matrix* m;
@@ -40,10 +43,15 @@ typedef struct
   } s;
 } SYMTAB;
 
-extern SYMTAB symtab[MAX_SYMBOLS];
+/* each symbol is allocated on its own, so pointers to it stay valid as
+   symtab grows */
+extern SYMTAB** symtab;
 
 extern int lastsym;
 
+/* set if a symbol could not be added, so the parser can stop */
+extern int symtab_failed;
+
 SYMTAB*
 lookup_symbol(char*);
 
@@ -59,10 +67,10 @@ print_light(struct light*);
 void
 print_symtab();
 
-SYMTAB*
-add_symbol(char*, int, void*);
-
 void
 set_value(SYMTAB*, double);
 
+void
+clear_symtab();
+
 #endif
@@ -0,0 +1,724 @@
+/*
+Texture mapping, for the texture command and meshes with OBJ texture
+coordinates. Images are read once, from PPM directly or from anything else
+through convert, and kept for the rest of the process; refresh_textures
+reads the ones whose files have changed again.
+
+Every image is stored with all its mipmap levels, each one halving the one
+before with a box filter down to 1 x 1. Texels in a level are laid out in
+TEXTURE_TILE x TEXTURE_TILE tiles, so the texels around a sample are a few
+cache lines apart whichever way the triangle runs across the image.
+
+Triangles are filled with edge functions, and u, v and z come from the
+barycentric weights at each pixel. The projection is orthographic, so this
+is already perspective correct, and the rate at which u and v change across
+the screen is the same everywhere on a triangle: the mipmap level is picked
+once per triangle, and samples are blended from the two nearest levels
+(trilinear filtering). A minified texture is read from a level about the
+size it appears on screen, instead of skipping through the full image.
+Under --raster fixed the pixels and their weights come from fixed_shaded
+instead.
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "draw.h"
+#include "fixed.h"
+#include "matrix.h"
+#include "meshcache.h"
+#include "ml6.h"
+#include "options.h"
+#include "profile.h"
+#include "texture.h"
+
+struct texture_set textures;
+
+static int
+read_number(FILE* f)
+{
+  /*
+  Read the next number of a PPM file, skipping whitespace and comments.
+  The character after the number is consumed. Returns -1 if there is no
+  number.
+
+  @param: FILE* f
+
+  @return: int
+  */
+  int c, n;
+
+  c = getc(f);
+  while (c != EOF && (isspace(c) || c == '#')) {
+    if (c == '#')
+      while (c != EOF && c != '\n')
+        c = getc(f);
+    c = getc(f);
+  }
+  if (c == EOF || !isdigit(c))
+    return -1;
+
+  n = 0;
+  while (c != EOF && isdigit(c) && n < 1 << 24) {
+    n = n * 10 + c - '0';
+    c = getc(f);
+  }
+  return n;
+}
+
+static unsigned char*
+read_ppm(FILE* f, int* width, int* height)
+{
+  /*
+  Read a P3 or P6 image from f into red, green, blue bytes, top row first.
+  Returns NULL if f does not hold one.
+
+  @param: FILE* f
+  @param: int* width
+  @param: int* height
+
+  @return: unsigned char*
+  */
+  unsigned char* rgb;
+  int format, max, n, i, value, high;
+
+  if (getc(f) != 'P')
+    return NULL;
+  format = getc(f);
+  if (format != '3' && format != '6')
+    return NULL;
+
+  *width = read_number(f);
+  *height = read_number(f);
+  max = read_number(f);
+  if (*width <= 0 || *height <= 0 || *width > 1 << 14 ||
+      *height > 1 << 14 || max <= 0 || max > 65535)
+    return NULL;
+
+  n = *width * *height * 3;
+  rgb = (unsigned char*)malloc(n);
+  for (i = 0; i < n; i++) {
+    if (format == '3')
+      value = read_number(f);
+    else if (max < 256)
+      value = getc(f);
+    else {
+      high = getc(f);
+      value = high == EOF ? EOF : high << 8 | getc(f);
+    }
+    if (value < 0) {
+      free(rgb);
+      return NULL;
+    }
+    rgb[i] = (unsigned char)((value > max ? max : value) * 255 / max);
+  }
+  return rgb;
+}
+
+static struct texel*
+texel_at(struct texture_level* level, int x, int y)
+{
+  /*
+  The texel at column x and row y of level, counting rows from the bottom.
+
+  @param: struct texture_level* level
+  @param: int x
+  @param: int y
+
+  @return: struct texel*
+  */
+  int tile = (y >> TEXTURE_TILE_BITS) * level->tiles + (x >> TEXTURE_TILE_BITS);
+
+  return &level->texels[(tile << 2 * TEXTURE_TILE_BITS) +
+                        ((y & (TEXTURE_TILE - 1)) << TEXTURE_TILE_BITS) +
+                        (x & (TEXTURE_TILE - 1))];
+}
+
+static void
+new_level(struct texture_level* level, int width, int height)
+{
+  /*
+  Allocate a level of width x height texels, rounded up to whole tiles.
+
+  @param: struct texture_level* level
+  @param: int width
+  @param: int height
+
+  @return: void
+  */
+  int rows = (height + TEXTURE_TILE - 1) / TEXTURE_TILE;
+
+  level->width = width;
+  level->height = height;
+  level->tiles = (width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+  level->texels = (struct texel*)calloc(
+    level->tiles * rows * TEXTURE_TILE * TEXTURE_TILE, sizeof(struct texel));
+}
+
+static void
+build_levels(struct texture* t, unsigned char* rgb, int width, int height)
+{
+  /*
+  Store the image in rgb as level 0 of t, and make the levels below it
+  by averaging 2 x 2 blocks of texels.
+
+  @param: struct texture* t
+  @param: unsigned char* rgb
+  @param: int width
+  @param: int height
+
+  @return: void
+  */
+  struct texture_level *from, *to;
+  struct texel *a, *b, *c, *d, *out;
+  int x, y, n, x1, y1;
+
+  new_level(&t->level[0], width, height);
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      out = texel_at(&t->level[0], x, height - 1 - y);
+      out->red = rgb[(y * width + x) * 3];
+      out->green = rgb[(y * width + x) * 3 + 1];
+      out->blue = rgb[(y * width + x) * 3 + 2];
+    }
+  }
+
+  for (n = 1; n < TEXTURE_LEVELS; n++) {
+    from = &t->level[n - 1];
+    if (from->width == 1 && from->height == 1)
+      break;
+    to = &t->level[n];
+    new_level(to,
+              from->width > 1 ? from->width / 2 : 1,
+              from->height > 1 ? from->height / 2 : 1);
+
+    for (y = 0; y < to->height; y++) {
+      for (x = 0; x < to->width; x++) {
+        x1 = 2 * x + 1 < from->width ? 2 * x + 1 : 2 * x;
+        y1 = 2 * y + 1 < from->height ? 2 * y + 1 : 2 * y;
+        a = texel_at(from, 2 * x, 2 * y);
+        b = texel_at(from, x1, 2 * y);
+        c = texel_at(from, 2 * x, y1);
+        d = texel_at(from, x1, y1);
+        out = texel_at(to, x, y);
+        out->red = (a->red + b->red + c->red + d->red + 2) / 4;
+        out->green = (a->green + b->green + c->green + d->green + 2) / 4;
+        out->blue = (a->blue + b->blue + c->blue + d->blue + 2) / 4;
+      }
+    }
+  }
+  t->levels = n;
+}
+
+static unsigned char*
+read_converted(char* file, int* width, int* height)
+{
+  /*
+  Read an image in a format other than PPM by running convert on it and
+  reading the PPM it writes to a pipe. The file name is passed to convert
+  as an argument of its own, never through a shell, since it comes from
+  the script. Returns NULL if convert could not read it.
+
+  @param: char* file
+  @param: int* width
+  @param: int* height
+
+  @return: unsigned char*
+  */
+  unsigned char* rgb;
+  int out[2];
+  pid_t pid;
+  FILE* f;
+
+  if (pipe(out) != 0)
+    return NULL;
+  /* so the child does not write what is still buffered a second time */
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    close(out[0]);
+    close(out[1]);
+    return NULL;
+  }
+  if (pid == 0) {
+    dup2(out[1], STDOUT_FILENO);
+    close(out[0]);
+    close(out[1]);
+    execlp("convert", "convert", file, "ppm:-", NULL);
+    _exit(127);
+  }
+
+  close(out[1]);
+  f = fdopen(out[0], "r");
+  if (f == NULL) {
+    close(out[0]);
+    waitpid(pid, NULL, 0);
+    return NULL;
+  }
+  rgb = read_ppm(f, width, height);
+  fclose(f);
+  waitpid(pid, NULL, 0);
+  return rgb;
+}
+
+static int
+read_texture(struct texture* t)
+{
+  /*
+  Read the image t is named after and build its levels, replacing the ones
+  it has. Returns 0 if it could not be read, leaving t as it was, so a
+  texture whose file is removed or half written keeps its last image.
+
+  @param: struct texture* t
+
+  @return: int
+  */
+  unsigned char* rgb = NULL;
+  char* extension = strrchr(t->name, '.');
+  FILE* f;
+  int width, height, n;
+  struct texture fresh;
+
+  t->stamp = file_stamp(t->name);
+  if (extension &&
+      (strcmp(extension, ".ppm") == 0 || strcmp(extension, ".pnm") == 0)) {
+    f = fopen(t->name, "rb");
+    if (f) {
+      rgb = read_ppm(f, &width, &height);
+      fclose(f);
+    }
+  } else
+    rgb = read_converted(t->name, &width, &height);
+
+  if (!rgb) {
+    printf("Error: could not load texture %s\n", t->name);
+    return 0;
+  }
+  memset(&fresh, 0, sizeof(fresh));
+  build_levels(&fresh, rgb, width, height);
+  free(rgb);
+
+  for (n = 0; n < t->levels; n++)
+    free(t->level[n].texels);
+  t->levels = fresh.levels;
+  memcpy(t->level, fresh.level, sizeof(t->level));
+  return 1;
+}
+
+int
+load_texture(char* file)
+{
+  /*
+  Return the number of the texture in file, loading it the first time it
+  is asked for. Returns NO_TEXTURE if it could not be read.
+
+  @param: char* file
+
+  @return: int
+  */
+  struct texture* t;
+  int i;
+
+  for (i = 0; i < textures.count; i++)
+    if (strcmp(textures.list[i].name, file) == 0)
+      return textures.list[i].levels ? i : NO_TEXTURE;
+
+  if (textures.count == textures.capacity) {
+    textures.capacity = textures.capacity ? 2 * textures.capacity : 8;
+    textures.list = (struct texture*)realloc(
+      textures.list, textures.capacity * sizeof(struct texture));
+  }
+  t = &textures.list[textures.count++];
+  memset(t, 0, sizeof(struct texture));
+  t->name = strdup(file);
+
+  return read_texture(t) ? textures.count - 1 : NO_TEXTURE;
+}
+
+void
+refresh_textures()
+{
+  /*
+  Read every texture whose file has changed since it was loaded again,
+  keeping its number, so the meshes that use it stay valid. A texture that
+  cannot be read keeps the image it had.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+  struct texture* t;
+
+  for (i = 0; i < textures.count; i++) {
+    t = &textures.list[i];
+    if (file_stamp(t->name) != t->stamp)
+      read_texture(t);
+  }
+}
+
+void
+add_uv(struct matrix* uvs, double u, double v, int t)
+{
+  /*
+  Add texture coordinates (u, v) in texture t for the next point.
+
+  @param: struct matrix* uvs
+  @param: double u
+  @param: double v
+  @param: int t
+
+  @return: void
+  */
+  if (uvs->lastcol == uvs->cols)
+    grow_matrix(uvs, 2 * uvs->lastcol + 100);
+
+  uvs->m[0][uvs->lastcol] = u;
+  uvs->m[1][uvs->lastcol] = v;
+  uvs->m[2][uvs->lastcol] = t;
+  uvs->lastcol++;
+}
+
+void
+add_texture_quad(struct matrix* polygons,
+                 struct matrix* uvs,
+                 double* d0,
+                 double* d1,
+                 double* d2,
+                 double* d3,
+                 int t)
+{
+  /*
+  Add the quad with corners d0, d1, d2 and d3 as two triangles, with the
+  bottom left of texture t at d0, bottom right at d1, top right at d2 and
+  top left at d3.
+
+  @param: struct matrix* polygons
+  @param: struct matrix* uvs
+  @param: double* d0
+  @param: double* d1
+  @param: double* d2
+  @param: double* d3
+  @param: int t
+
+  @return: void
+  */
+  add_polygon(
+    polygons, d0[0], d0[1], d0[2], d1[0], d1[1], d1[2], d2[0], d2[1], d2[2]);
+  add_uv(uvs, 0, 0, t);
+  add_uv(uvs, 1, 0, t);
+  add_uv(uvs, 1, 1, t);
+  add_polygon(
+    polygons, d0[0], d0[1], d0[2], d2[0], d2[1], d2[2], d3[0], d3[1], d3[2]);
+  add_uv(uvs, 0, 0, t);
+  add_uv(uvs, 1, 1, t);
+  add_uv(uvs, 0, 1, t);
+}
+
+color
+texture_flat(int t, color lit)
+{
+  /*
+  The average color of texture t (its last level) lit by lit, for where
+  a textured triangle is drawn in one color. A texture with no image
+  leaves lit as it is.
+
+  @param: int t
+  @param: color lit
+
+  @return: color
+  */
+  struct texture* texture = &textures.list[t];
+  struct texel* average;
+  color c;
+
+  if (texture->levels == 0)
+    return lit;
+  average = texel_at(&texture->level[texture->levels - 1], 0, 0);
+
+  c.red = average->red * lit.red / MAX_COLOR;
+  c.green = average->green * lit.green / MAX_COLOR;
+  c.blue = average->blue * lit.blue / MAX_COLOR;
+  return c;
+}
+
+static int
+wrap(int n, int size)
+{
+  /*
+  n wrapped into [0, size), so textures repeat.
+
+  @param: int n
+  @param: int size
+
+  @return: int
+  */
+  n %= size;
+  return n < 0 ? n + size : n;
+}
+
+static void
+bilinear(struct texture_level* level, double u, double v, double* rgb)
+{
+  /*
+  Sample level at (u, v) in [0, 1), blending the four nearest texels.
+
+  @param: struct texture_level* level
+  @param: double u
+  @param: double v
+  @param: double* rgb
+
+  @return: void
+  */
+  double x = u * level->width - 0.5;
+  double y = v * level->height - 0.5;
+  double fx = floor(x);
+  double fy = floor(y);
+  int x0 = wrap((int)fx, level->width);
+  int y0 = wrap((int)fy, level->height);
+  int x1 = wrap(x0 + 1, level->width);
+  int y1 = wrap(y0 + 1, level->height);
+  struct texel* a = texel_at(level, x0, y0);
+  struct texel* b = texel_at(level, x1, y0);
+  struct texel* c = texel_at(level, x0, y1);
+  struct texel* d = texel_at(level, x1, y1);
+
+  x -= fx;
+  y -= fy;
+  rgb[0] = (a->red + (b->red - a->red) * x) * (1 - y) +
+           (c->red + (d->red - c->red) * x) * y;
+  rgb[1] = (a->green + (b->green - a->green) * x) * (1 - y) +
+           (c->green + (d->green - c->green) * x) * y;
+  rgb[2] = (a->blue + (b->blue - a->blue) * x) * (1 - y) +
+           (c->blue + (d->blue - c->blue) * x) * y;
+}
+
+static void
+sample(struct texture* t, double u, double v, double lod, double* rgb)
+{
+  /*
+  Sample t at (u, v) with mipmap level lod, blending the two levels on
+  either side of it.
+
+  @param: struct texture* t
+  @param: double u
+  @param: double v
+  @param: double lod
+  @param: double* rgb
+
+  @return: void
+  */
+  double below[3];
+  int n;
+
+  u -= floor(u);
+  v -= floor(v);
+  if (lod <= 0) {
+    bilinear(&t->level[0], u, v, rgb);
+    return;
+  }
+  if (lod >= t->levels - 1) {
+    bilinear(&t->level[t->levels - 1], u, v, rgb);
+    return;
+  }
+
+  n = (int)lod;
+  lod -= n;
+  bilinear(&t->level[n], u, v, rgb);
+  bilinear(&t->level[n + 1], u, v, below);
+  rgb[0] += (below[0] - rgb[0]) * lod;
+  rgb[1] += (below[1] - rgb[1]) * lod;
+  rgb[2] += (below[2] - rgb[2]) * lod;
+}
+
+/* what shade_texel needs to color the pixels of a textured triangle */
+struct texel_shading
+{
+  struct texture* t;
+  struct matrix* uvs;
+  int i;
+  double lod;
+  color lit;
+};
+
+static color
+shade_texel(double* weights, void* data)
+{
+  /*
+  The color of a pixel of a textured triangle under --raster fixed, from
+  the weights of its vertices there, as texture_triangle colors it.
+
+  @param: double* weights
+  @param: void* data
+
+  @return: color
+  */
+  struct texel_shading* shading = (struct texel_shading*)data;
+  double u = 0, v = 0, rgb[3];
+  color c;
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    u += weights[j] * shading->uvs->m[0][shading->i + j];
+    v += weights[j] * shading->uvs->m[1][shading->i + j];
+  }
+  sample(shading->t, u, v, shading->lod, rgb);
+  c.red = (int)(rgb[0] * shading->lit.red / MAX_COLOR + 0.5);
+  c.green = (int)(rgb[1] * shading->lit.green / MAX_COLOR + 0.5);
+  c.blue = (int)(rgb[2] * shading->lit.blue / MAX_COLOR + 0.5);
+  return c;
+}
+
+void
+texture_triangle(struct matrix* points,
+                 struct matrix* uvs,
+                 int i,
+                 screen s,
+                 zbuffer zb,
+                 color lit)
+{
+  /*
+  Fill triangle i of points with its texture from uvs, lit by lit, or just
+  with lit if the texture has no image.
+
+  @param: struct matrix* points
+  @param: struct matrix* uvs
+  @param: int i
+  @param: screen s
+  @param: zbuffer zb
+  @param: color lit
+
+  @return: void
+  */
+  struct texture* t = &textures.list[(int)uvs->m[2][i]];
+  double x[3], y[3], z[3], u[3], v[3];
+  double a[3], b[3], e[3], w[3];
+  double area, swap, dudx, dudy, dvdx, dvdy, rho, lod, rgb[3];
+  int edge[3];
+  int xmin, xmax, ymin, ymax, col, line, row, j, p, q;
+  depth_t depth;
+  struct texel_shading shading;
+
+  if (t->levels == 0) {
+    scanline_convert(points, i, s, zb, lit);
+    return;
+  }
+
+  for (j = 0; j < 3; j++) {
+    x[j] = points->m[0][i + j];
+    y[j] = points->m[1][i + j];
+    z[j] = points->m[2][i + j];
+    u[j] = uvs->m[0][i + j];
+    v[j] = uvs->m[1][i + j];
+  }
+
+  area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0)
+    return;
+  if (area < 0) {
+    /* make the winding counterclockwise */
+    swap = x[1], x[1] = x[2], x[2] = swap;
+    swap = y[1], y[1] = y[2], y[2] = swap;
+    swap = z[1], z[1] = z[2], z[2] = swap;
+    swap = u[1], u[1] = u[2], u[2] = swap;
+    swap = v[1], v[1] = v[2], v[2] = swap;
+    area = -area;
+  }
+
+  /*
+  Edge j runs from vertex p to vertex q, opposite vertex j, and is
+  (a * x + b * y + e) / area, the weight of vertex j. Pixels exactly on an
+  edge only count for top and left edges.
+  */
+  for (j = 0; j < 3; j++) {
+    p = (j + 1) % 3;
+    q = (j + 2) % 3;
+    a[j] = (y[p] - y[q]) / area;
+    b[j] = (x[q] - x[p]) / area;
+    e[j] = (x[p] * y[q] - y[p] * x[q]) / area;
+    edge[j] = a[j] > 0 || (a[j] == 0 && b[j] < 0);
+  }
+
+  /* texels per pixel, the same across the whole triangle */
+  dudx = (a[0] * u[0] + a[1] * u[1] + a[2] * u[2]) * t->level[0].width;
+  dvdx = (a[0] * v[0] + a[1] * v[1] + a[2] * v[2]) * t->level[0].height;
+  dudy = (b[0] * u[0] + b[1] * u[1] + b[2] * u[2]) * t->level[0].width;
+  dvdy = (b[0] * v[0] + b[1] * v[1] + b[2] * v[2]) * t->level[0].height;
+  rho = fmax(hypot(dudx, dvdx), hypot(dudy, dvdy));
+  lod = rho > 1 ? log2(rho) : 0;
+
+  if (opts.raster == RASTER_FIXED) {
+    shading.t = t;
+    shading.uvs = uvs;
+    shading.i = i;
+    shading.lod = lod;
+    shading.lit = lit;
+    if (fixed_shaded(points, i, s, zb, shade_texel, &shading))
+      return;
+  }
+
+  xmin = (int)ceil(fmin(x[0], fmin(x[1], x[2])));
+  xmax = (int)floor(fmax(x[0], fmax(x[1], x[2])));
+  ymin = (int)ceil(fmin(y[0], fmin(y[1], y[2])));
+  ymax = (int)floor(fmax(y[0], fmax(y[1], y[2])));
+  xmin = xmin < 0 ? 0 : xmin;
+  ymin = ymin < 0 ? 0 : ymin;
+  xmax = xmax >= XRES ? XRES - 1 : xmax;
+  ymax = ymax >= YRES ? YRES - 1 : ymax;
+
+  for (line = ymin; line <= ymax; line++) {
+    row = YRES - 1 - line;
+    for (j = 0; j < 3; j++)
+      w[j] = a[j] * xmin + b[j] * line + e[j];
+
+    for (col = xmin; col <= xmax;
+         col++, w[0] += a[0], w[1] += a[1], w[2] += a[2]) {
+      if (w[0] < 0 || w[1] < 0 || w[2] < 0 || (w[0] == 0 && !edge[0]) ||
+          (w[1] == 0 && !edge[1]) || (w[2] == 0 && !edge[2]))
+        continue;
+
+      depth = DEPTH_ENCODE(
+        (int)((w[0] * z[0] + w[1] * z[1] + w[2] * z[2]) * 1000) / 1000.0);
+      prof.depth_tests++;
+      if (!DEPTH_TEST(zb[col][row], depth))
+        continue;
+
+      sample(t,
+             w[0] * u[0] + w[1] * u[1] + w[2] * u[2],
+             w[0] * v[0] + w[1] * v[1] + w[2] * v[2],
+             lod,
+             rgb);
+      s[col][row].red = (int)(rgb[0] * lit.red / MAX_COLOR + 0.5);
+      s[col][row].green = (int)(rgb[1] * lit.green / MAX_COLOR + 0.5);
+      s[col][row].blue = (int)(rgb[2] * lit.blue / MAX_COLOR + 0.5);
+      zb[col][row] = depth;
+      prof.pixels++;
+    }
+  }
+}
+
+void
+free_textures()
+{
+  /*
+  Release every texture that was loaded.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i, n;
+
+  for (i = 0; i < textures.count; i++) {
+    for (n = 0; n < textures.list[i].levels; n++)
+      free(textures.list[i].level[n].texels);
+    free(textures.list[i].name);
+  }
+  free(textures.list);
+  memset(&textures, 0, sizeof(textures));
+}
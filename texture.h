@@ -0,0 +1,73 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+/* texels are stored in square tiles of TEXTURE_TILE x TEXTURE_TILE */
+#define TEXTURE_TILE_BITS 3
+#define TEXTURE_TILE (1 << TEXTURE_TILE_BITS)
+#define TEXTURE_LEVELS 16
+/* uvs matrices hold u, v and the texture number for each point */
+#define UV_ROWS 3
+#define NO_TEXTURE -1
+
+struct texel
+{
+  unsigned char red, green, blue, pad;
+};
+
+struct texture_level
+{
+  int width, height;
+  /* tiles in a row of tiles */
+  int tiles;
+  struct texel* texels;
+};
+
+struct texture
+{
+  char* name;
+  /* file_stamp of the image when it was read */
+  long long stamp;
+  /* 0 if the image could not be loaded */
+  int levels;
+  struct texture_level level[TEXTURE_LEVELS];
+};
+
+struct texture_set
+{
+  struct texture* list;
+  int count, capacity;
+};
+
+extern struct texture_set textures;
+
+int
+load_texture(char*);
+
+void
+refresh_textures();
+
+void
+add_uv(struct matrix*, double, double, int);
+
+void
+add_texture_quad(struct matrix*,
+                 struct matrix*,
+                 double*,
+                 double*,
+                 double*,
+                 double*,
+                 int);
+
+color
+texture_flat(int, color);
+
+void
+texture_triangle(struct matrix*, struct matrix*, int, screen, zbuffer, color);
+
+void
+free_textures();
+
+#endif
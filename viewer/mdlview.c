@@ -0,0 +1,167 @@
+/*
+Minimal viewer for the preview ring that mdl --preview publishes. It maps
+the shared memory read only, and for every new frame prints its number and
+checksum (the same FNV-1a the renderer uses, so runs can be compared with
+--bench output). With -o the latest frame is also written as a PPM, which
+an image viewer that reloads on change can show live. Frames that were
+overwritten before they could be read are counted as dropped.
+
+Usage: viewer/mdlview [-o frame.ppm] [name]
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ml6.h"
+#include "preview.h"
+
+struct preview_ring*
+attach(char* name)
+{
+  /*
+  Map the ring name, waiting up to ten seconds for the renderer to create
+  it.
+
+  @param: char* name
+
+  @return: struct preview_ring*
+  */
+  int fd = -1;
+  int tries;
+  struct preview_ring* ring;
+
+  for (tries = 0; fd < 0 && tries < 100; tries++) {
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+      usleep(100000);
+  }
+  if (fd < 0) {
+    printf("Error: no preview ring called %s\n", name);
+    exit(1);
+  }
+
+  ring = (struct preview_ring*)mmap(
+    NULL, sizeof(struct preview_ring), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED) {
+    printf("Error: could not map %s\n", name);
+    exit(1);
+  }
+
+  while (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != PREVIEW_MAGIC)
+    usleep(1000);
+  if (ring->width != XRES || ring->height != YRES ||
+      ring->slots != PREVIEW_SLOTS) {
+    printf("Error: %s is %dx%d with %d slots, expected %dx%d with %d\n",
+           name,
+           ring->width,
+           ring->height,
+           ring->slots,
+           XRES,
+           YRES,
+           PREVIEW_SLOTS);
+    exit(1);
+  }
+  return ring;
+}
+
+void
+save_frame(char* file, unsigned char* rgb)
+{
+  /*
+  Write rgb as a P6 file, through a temporary file so a viewer never sees
+  half of one.
+
+  @param: char* file
+  @param: unsigned char* rgb
+
+  @return: void
+  */
+  char tmp[256];
+  FILE* f;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  f = fopen(tmp, "wb");
+  if (!f)
+    return;
+  fprintf(f, "P6\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
+  fwrite(rgb, 1, XRES * YRES * 3, f);
+  fclose(f);
+  rename(tmp, file);
+}
+
+int
+main(int argc, char** argv)
+{
+  int c, i, frame;
+  char* name = PREVIEW_DEFAULT;
+  char* file = NULL;
+  unsigned char* copy = NULL;
+  unsigned long long seen = 0, published, seq, hash;
+  long shown = 0, dropped = 0, torn = 0;
+  struct preview_ring* ring;
+  struct preview_slot* slot;
+
+  while ((c = getopt(argc, argv, "o:")) != -1) {
+    if (c == 'o')
+      file = optarg;
+    else {
+      printf("Usage: %s [-o frame.ppm] [name]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind < argc)
+    name = argv[optind];
+  if (file)
+    copy = (unsigned char*)malloc(XRES * YRES * 3);
+
+  ring = attach(name);
+
+  while (1) {
+    published = __atomic_load_n(&ring->published, __ATOMIC_ACQUIRE);
+    if (published == seen) {
+      if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+          __atomic_load_n(&ring->published, __ATOMIC_ACQUIRE) == seen)
+        break;
+      usleep(1000);
+      continue;
+    }
+
+    slot = &ring->slot[(published - 1) % PREVIEW_SLOTS];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    frame = slot->frame;
+    hash = CHECKSUM_SEED;
+    for (i = 0; i < XRES * YRES * 3; i++)
+      hash = (hash ^ slot->rgb[i]) * 1099511628211ULL;
+    if (copy)
+      memcpy(copy, slot->rgb, XRES * YRES * 3);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+      torn++;
+      continue;
+    }
+
+    dropped += published - seen - 1;
+    seen = published;
+    shown++;
+    printf("frame %d checksum %016llx\n", frame, hash);
+    fflush(stdout);
+    if (copy)
+      save_frame(file, copy);
+  }
+
+  printf("%ld frames shown, %ld dropped, %ld torn reads retried\n",
+         shown,
+         dropped,
+         torn);
+  munmap(ring, sizeof(struct preview_ring));
+  return 0;
+}
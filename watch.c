@@ -0,0 +1,180 @@
+/*
+--watch: after each run, wait for the script or one of the files it reads
+to change, then run it again in the same process. Changes are found with
+inotify. The directories holding the files are watched rather than the
+files themselves, since editors often save by writing a new file and
+renaming it over the old one, which a watch on the old file would miss.
+
+Nothing has to be thrown away between runs: meshes, tessellations and
+textures stay loaded (see meshcache.c), and the frame cache only renders
+the frames whose keys changed.
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "mesh.h"
+#include "options.h"
+#include "parser.h"
+#include "texture.h"
+#include "watch.h"
+#include "y.tab.h"
+
+struct watch_list watched;
+
+void
+watch_start()
+{
+  /*
+  Open the inotify instance. It stays open between runs, so a file saved
+  while the script is rendering still counts as a change.
+
+  @param: No parameters
+
+  @return: void
+  */
+  memset(&watched, 0, sizeof(watched));
+  watched.fd = inotify_init1(IN_CLOEXEC);
+  if (watched.fd < 0) {
+    perror("Error: inotify_init1");
+    exit(1);
+  }
+}
+
+static void
+watch_file(char* file)
+{
+  /*
+  Add file to the list, and watch the directory it is in.
+
+  @param: char* file
+
+  @return: void
+  */
+  char dir[512];
+  char* slash = strrchr(file, '/');
+  int i;
+
+  for (i = 0; i < watched.count; i++)
+    if (strcmp(watched.files[i], file) == 0)
+      return;
+  if (watched.count == WATCH_FILES)
+    return;
+
+  if (slash == NULL)
+    strcpy(dir, ".");
+  else
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - file + 1), file);
+
+  i = inotify_add_watch(
+    watched.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if (i < 0) {
+    printf("Warning: cannot watch %s for changes to %s\n", dir, file);
+    return;
+  }
+  watched.dirs[watched.count] = i;
+  watched.files[watched.count++] = strdup(file);
+}
+
+void
+watch_files()
+{
+  /*
+  Make the list of files to watch: the script, the meshes and textures it
+  draws, and the MTL libraries and textures its meshes use.
+
+  @param: No parameters
+
+  @return: void
+  */
+  char files[M_FILES][M_PATH];
+  int i, j, n;
+
+  for (i = 0; i < watched.count; i++)
+    free(watched.files[i]);
+  watched.count = 0;
+
+  watch_file(opts.script);
+  for (i = 0; i < lastop; i++) {
+    if (op[i].opcode == MESH) {
+      watch_file(op[i].op.mesh.name);
+      n = mesh_files(op[i].op.mesh.name, files, M_FILES);
+      for (j = 0; j < n; j++)
+        watch_file(files[j]);
+    } else if (op[i].opcode == TEXTURE)
+      watch_file(op[i].op.texture.p->name);
+  }
+  for (i = 0; i < textures.count; i++)
+    watch_file(textures.list[i].name);
+}
+
+static int
+changed(char* buffer, int size)
+{
+  /*
+  Go through the events read into buffer, and return 1 if one of them is
+  about a watched file.
+
+  @param: char* buffer
+  @param: int size
+
+  @return: int
+  */
+  struct inotify_event* event;
+  char* base;
+  char* p;
+  int i, found = 0;
+
+  for (p = buffer; p < buffer + size; p += sizeof(*event) + event->len) {
+    event = (struct inotify_event*)p;
+    if (event->len == 0)
+      continue;
+    for (i = 0; i < watched.count; i++) {
+      base = strrchr(watched.files[i], '/');
+      base = base ? base + 1 : watched.files[i];
+      if (watched.dirs[i] == event->wd && strcmp(base, event->name) == 0) {
+        if (!found)
+          printf("\nChanged: %s\n", watched.files[i]);
+        found = 1;
+      }
+    }
+  }
+  return found;
+}
+
+void
+watch_wait()
+{
+  /*
+  Block until one of the watched files changes, then wait for the changes
+  to settle for WATCH_QUIET milliseconds, since saving a file often takes
+  several writes.
+
+  @param: No parameters
+
+  @return: void
+  */
+  char buffer[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd quiet = { watched.fd, POLLIN, 0 };
+  int n;
+
+  printf("\nWatching %d files for changes\n", watched.count);
+  fflush(stdout);
+
+  do {
+    n = read(watched.fd, buffer, sizeof(buffer));
+    if (n <= 0) {
+      perror("Error: reading inotify events");
+      exit(1);
+    }
+  } while (!changed(buffer, n));
+
+  while (poll(&quiet, 1, WATCH_QUIET) > 0)
+    if (read(watched.fd, buffer, sizeof(buffer)) <= 0)
+      break;
+}
@@ -0,0 +1,27 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#define WATCH_FILES 256
+/* milliseconds without another change before the script is run again */
+#define WATCH_QUIET 100
+
+struct watch_list
+{
+  int fd;
+  int count;
+  char* files[WATCH_FILES];
+  int dirs[WATCH_FILES];
+};
+
+extern struct watch_list watched;
+
+void
+watch_start();
+
+void
+watch_files();
+
+void
+watch_wait();
+
+#endif
@@ -0,0 +1,308 @@
+/*
+Wireframe rendering, used by shading wireframe. The edges of the front
+facing triangles of polygon geometry are drawn instead of their faces.
+Triangles come in as three separate points each, so an edge shared by two
+triangles appears twice; edges are looked up by their endpoint coordinates
+in a hash table and each one is drawn once. Every line is clipped to the
+screen (Liang-Barsky) before it is stepped, so no time goes to pixels that
+would be rejected, and the pixels are worked out in chunks with no
+dependence from one to the next before the depth tests.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matrix.h"
+#include "ml6.h"
+#include "perfctr.h"
+#include "profile.h"
+#include "wireframe.h"
+
+/* edge table: columns of the two endpoints of each edge, -1 when empty */
+static int* edge_from = NULL;
+static int* edge_to = NULL;
+static int edge_size = 0;
+
+static int
+clip_side(double p, double q, double* t0, double* t1)
+{
+  /*
+  Narrow [t0, t1] to where p * t <= q holds. Returns 0 once nothing is
+  left.
+
+  @param: double p
+  @param: double q
+  @param: double* t0
+  @param: double* t1
+
+  @return: int
+  */
+  double r;
+
+  if (p == 0)
+    return q >= 0;
+  r = q / p;
+  if (p < 0) {
+    if (r > *t1)
+      return 0;
+    if (r > *t0)
+      *t0 = r;
+  } else {
+    if (r < *t0)
+      return 0;
+    if (r < *t1)
+      *t1 = r;
+  }
+  return 1;
+}
+
+int
+clip_line(double* x0,
+          double* y0,
+          double* z0,
+          double* x1,
+          double* y1,
+          double* z1)
+{
+  /*
+  Clip the line from (x0, y0, z0) to (x1, y1, z1) to the screen with the
+  Liang-Barsky algorithm, moving the endpoints (and their z) in place.
+  Returns 0 if none of the line is on screen.
+
+  @param: double* x0
+  @param: double* y0
+  @param: double* z0
+  @param: double* x1
+  @param: double* y1
+  @param: double* z1
+
+  @return: int
+  */
+  double dx = *x1 - *x0;
+  double dy = *y1 - *y0;
+  double dz = *z1 - *z0;
+  double t0 = 0;
+  double t1 = 1;
+
+  if (!clip_side(-dx, *x0, &t0, &t1) ||
+      !clip_side(dx, XRES - 1 - *x0, &t0, &t1) ||
+      !clip_side(-dy, *y0, &t0, &t1) ||
+      !clip_side(dy, YRES - 1 - *y0, &t0, &t1))
+    return 0;
+
+  if (t1 < 1) {
+    *x1 = *x0 + t1 * dx;
+    *y1 = *y0 + t1 * dy;
+    *z1 = *z0 + t1 * dz;
+  }
+  if (t0 > 0) {
+    *x0 += t0 * dx;
+    *y0 += t0 * dy;
+    *z0 += t0 * dz;
+  }
+  return 1;
+}
+
+void
+wire_line(double x0,
+          double y0,
+          double z0,
+          double x1,
+          double y1,
+          double z1,
+          screen s,
+          zbuffer zb,
+          color c)
+{
+  /*
+  Draw a line with depth testing. The line is clipped first, then stepped
+  one pixel at a time along its longer axis. Positions and depths for up
+  to WIRE_CHUNK pixels are computed together from the start of the line
+  (so the loop vectorizes), then plotted.
+
+  @param: double x0
+  @param: double y0
+  @param: double z0
+  @param: double x1
+  @param: double y1
+  @param: double z1
+  @param: screen s
+  @param: zbuffer zb
+  @param: color c
+
+  @return: void
+  */
+  int col[WIRE_CHUNK], row[WIRE_CHUNK];
+  depth_t depth[WIRE_CHUNK];
+  double sx, sy, sz;
+  int i, k, n, count;
+
+  if (!clip_line(&x0, &y0, &z0, &x1, &y1, &z1))
+    return;
+
+  n = (int)ceil(fmax(fabs(x1 - x0), fabs(y1 - y0)));
+  sx = n ? (x1 - x0) / n : 0;
+  sy = n ? (y1 - y0) / n : 0;
+  sz = n ? (z1 - z0) / n : 0;
+
+  for (i = 0; i <= n; i += WIRE_CHUNK) {
+    count = n + 1 - i < WIRE_CHUNK ? n + 1 - i : WIRE_CHUNK;
+
+    for (k = 0; k < count; k++) {
+      col[k] = (int)(x0 + (i + k) * sx + 0.5);
+      row[k] = YRES - 1 - (int)(y0 + (i + k) * sy + 0.5);
+      depth[k] =
+        DEPTH_ENCODE((int)((z0 + (i + k) * sz) * 1000) / 1000.0);
+    }
+
+    for (k = 0; k < count; k++) {
+      if (DEPTH_TEST(zb[col[k]][row[k]], depth[k])) {
+        s[col[k]][row[k]] = c;
+        zb[col[k]][row[k]] = depth[k];
+        prof.pixels++;
+      }
+    }
+    prof.depth_tests += count;
+  }
+}
+
+static unsigned long long
+hash_point(struct matrix* points, int i)
+{
+  /*
+  Hash the coordinates of column i. Adding 0.0 turns -0.0 into 0.0, which
+  compares equal to it.
+
+  @param: struct matrix* points
+  @param: int i
+
+  @return: unsigned long long
+  */
+  unsigned long long h = 0;
+  unsigned long long bits;
+  double v;
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    v = points->m[j][i] + 0.0;
+    memcpy(&bits, &v, sizeof(bits));
+    h = (h ^ bits) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+static int
+same_point(struct matrix* points, int a, int b)
+{
+  /*
+  Whether columns a and b of points are the same point.
+
+  @param: struct matrix* points
+  @param: int a
+  @param: int b
+
+  @return: int
+  */
+  return points->m[0][a] == points->m[0][b] &&
+         points->m[1][a] == points->m[1][b] &&
+         points->m[2][a] == points->m[2][b];
+}
+
+static int
+add_wire_edge(struct matrix* points, int a, int b)
+{
+  /*
+  Enter the edge between columns a and b in the edge table. Returns 1 if it
+  was not there yet, in either direction.
+
+  @param: struct matrix* points
+  @param: int a
+  @param: int b
+
+  @return: int
+  */
+  unsigned long long ha = hash_point(points, a);
+  unsigned long long hb = hash_point(points, b);
+  int i = (int)((ha + hb) & (edge_size - 1));
+
+  while (edge_from[i] >= 0) {
+    if ((same_point(points, edge_from[i], a) &&
+         same_point(points, edge_to[i], b)) ||
+        (same_point(points, edge_from[i], b) &&
+         same_point(points, edge_to[i], a)))
+      return 0;
+    i = (i + 1) & (edge_size - 1);
+  }
+  edge_from[i] = a;
+  edge_to[i] = b;
+  return 1;
+}
+
+void
+draw_wireframe(struct matrix* polygons, screen s, zbuffer zb, color c)
+{
+  /*
+  Draw each edge of the front facing triangles in polygons once, in
+  color c.
+
+  @param: struct matrix* polygons
+  @param: screen s
+  @param: zbuffer zb
+  @param: color c
+
+  @return: void
+  */
+  int point, j, a, b, size;
+  double nz;
+  int stage = perf.stage;
+
+  if (polygons->lastcol < 3) {
+    printf("Need at least 3 points to draw a polygon!\n");
+    return;
+  }
+
+  for (size = 16; size < 2 * polygons->lastcol; size *= 2)
+    ;
+  if (size > edge_size) {
+    free(edge_from);
+    free(edge_to);
+    edge_from = (int*)malloc(size * sizeof(int));
+    edge_to = (int*)malloc(size * sizeof(int));
+    edge_size = size;
+  }
+  memset(edge_from, -1, edge_size * sizeof(int));
+
+  perf_stage(STAGE_RASTER);
+  for (point = 0; point < polygons->lastcol - 2; point += 3) {
+    prof.triangles++;
+
+    /* z of the normal, as in calculate_normal */
+    nz = (polygons->m[0][point + 1] - polygons->m[0][point]) *
+           (polygons->m[1][point + 2] - polygons->m[1][point]) -
+         (polygons->m[1][point + 1] - polygons->m[1][point]) *
+           (polygons->m[0][point + 2] - polygons->m[0][point]);
+    if (nz <= 0) {
+      prof.culled++;
+      continue;
+    }
+
+    for (j = 0; j < 3; j++) {
+      a = point + j;
+      b = point + (j + 1) % 3;
+      if (add_wire_edge(polygons, a, b))
+        wire_line(polygons->m[0][a],
+                  polygons->m[1][a],
+                  polygons->m[2][a],
+                  polygons->m[0][b],
+                  polygons->m[1][b],
+                  polygons->m[2][b],
+                  s,
+                  zb,
+                  c);
+    }
+  }
+  perf_stage(stage);
+}
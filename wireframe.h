@@ -0,0 +1,27 @@
+#ifndef WIREFRAME_H
+#define WIREFRAME_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+/* pixels worked out at a time by wire_line before they are plotted */
+#define WIRE_CHUNK 64
+
+int
+clip_line(double*, double*, double*, double*, double*, double*);
+
+void
+wire_line(double,
+          double,
+          double,
+          double,
+          double,
+          double,
+          screen,
+          zbuffer,
+          color);
+
+void
+draw_wireframe(struct matrix*, screen, zbuffer, color);
+
+#endif
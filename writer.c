@@ -0,0 +1,248 @@
+/*
+Asynchronous frame writer.
+Finished framebuffers are handed to a background thread through a bounded
+queue and encoded there, while the interpreter renders the next frame into
+another buffer. There are only WRITER_BUFFERS framebuffers, so when the
+encoder falls behind writer_acquire blocks until one is written. A frame
+that cannot be streamed marks the writer failed, which the interpreter
+checks between frames so it can stop instead of exiting from this thread.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "display.h"
+#include "framecache.h"
+#include "ml6.h"
+#include "perfctr.h"
+#include "server.h"
+#include "stream.h"
+#include "writer.h"
+
+struct frame_writer writer;
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t freed = PTHREAD_COND_INITIALIZER;
+
+static int
+write_frame(struct write_job* job)
+{
+  /*
+  Encode one job with the same routines the interpreter used to call
+  directly. Animation frames are entered in the frame cache once saved,
+  and the client of a --server job is told about every saved file.
+  Returns 0 if a streamed frame could not be written.
+
+  @param: struct write_job* job
+
+  @return: int
+  */
+  if (job->kind == WRITER_DISPLAY)
+    display(*job->s);
+  else if (job->kind == WRITER_STREAM)
+    return stream_frame(*job->s);
+  else {
+    save_extension(*job->s, job->file);
+    cache_record(job->frame);
+    if (job->frame >= 0)
+      server_event("frame %d saved %s\n", job->frame, job->file);
+    else
+      server_event("saved %s\n", job->file);
+  }
+  return 1;
+}
+
+static void*
+writer_loop(void* arg)
+{
+  /*
+  Body of the writer thread. Takes jobs off the queue in order and gives
+  their buffers back once they are written. Returns after writer_stop once
+  the queue is empty. Under --perf the thread is counted as encode.
+
+  @param: void* arg
+
+  @return: void*
+  */
+  struct write_job job;
+  int written;
+
+  (void)arg;
+  perf_thread_open();
+  pthread_mutex_lock(&lock);
+  while (1) {
+    while (!writer.count && !writer.done)
+      pthread_cond_wait(&queued, &lock);
+    if (!writer.count)
+      break;
+
+    job = writer.queue[writer.head];
+    writer.head = (writer.head + 1) % WRITER_BUFFERS;
+    writer.count--;
+    writer.busy = 1;
+    pthread_mutex_unlock(&lock);
+
+    written = write_frame(&job);
+
+    pthread_mutex_lock(&lock);
+    writer.spare[writer.spare_count++] = job.s;
+    writer.busy = 0;
+    if (!written)
+      writer.failed = 1;
+    pthread_cond_broadcast(&freed);
+  }
+  pthread_mutex_unlock(&lock);
+  perf_thread_close();
+  return NULL;
+}
+
+void
+writer_start()
+{
+  /*
+  Allocate the framebuffers and start the writer thread. If the thread
+  cannot be created, frames are written synchronously by writer_submit.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  memset(&writer, 0, sizeof(writer));
+  for (i = 0; i < WRITER_BUFFERS; i++) {
+    writer.buffers[i] = (screen*)malloc(sizeof(screen));
+    writer.spare[writer.spare_count++] = writer.buffers[i];
+  }
+
+  writer.threaded = pthread_create(&thread, NULL, writer_loop, NULL) == 0;
+  if (!writer.threaded)
+    printf("Warning: could not start the writer thread, frames will be "
+           "written synchronously\n");
+}
+
+screen*
+writer_acquire()
+{
+  /*
+  Take a free framebuffer, waiting for the writer to finish one if they are
+  all in use.
+
+  @param: No parameters
+
+  @return: screen*
+  */
+  screen* s;
+
+  pthread_mutex_lock(&lock);
+  while (!writer.spare_count)
+    pthread_cond_wait(&freed, &lock);
+  s = writer.spare[--writer.spare_count];
+  pthread_mutex_unlock(&lock);
+  return s;
+}
+
+void
+writer_submit(screen* s, int kind, char* file, int frame)
+{
+  /*
+  Queue framebuffer s to be saved to file or displayed. frame is the
+  animation frame being saved, or -1. The buffer belongs to the writer from
+  here on and comes back through writer_acquire.
+
+  @param: screen* s
+  @param: int kind
+  @param: char* file
+  @param: int frame
+
+  @return: void
+  */
+  struct write_job job;
+  int written;
+
+  job.s = s;
+  job.kind = kind;
+  job.frame = frame;
+  strncpy(job.file, file ? file : "", sizeof(job.file) - 1);
+  job.file[sizeof(job.file) - 1] = 0;
+
+  if (!writer.threaded) {
+    written = write_frame(&job);
+    pthread_mutex_lock(&lock);
+    writer.spare[writer.spare_count++] = s;
+    if (!written)
+      writer.failed = 1;
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  writer.queue[(writer.head + writer.count) % WRITER_BUFFERS] = job;
+  writer.count++;
+  pthread_cond_signal(&queued);
+  pthread_mutex_unlock(&lock);
+}
+
+void
+writer_flush()
+{
+  /*
+  Wait until every queued frame has been written.
+
+  @param: No parameters
+
+  @return: void
+  */
+  pthread_mutex_lock(&lock);
+  while (writer.count || writer.busy)
+    pthread_cond_wait(&freed, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+int
+writer_failed()
+{
+  /*
+  Whether a frame handed to the writer could not be written.
+
+  @param: No parameters
+
+  @return: int
+  */
+  int failed;
+
+  pthread_mutex_lock(&lock);
+  failed = writer.failed;
+  pthread_mutex_unlock(&lock);
+  return failed;
+}
+
+void
+writer_stop()
+{
+  /*
+  Write out the remaining frames, stop the writer thread and free the
+  framebuffers, including any still held by the caller.
+
+  @param: No parameters
+
+  @return: void
+  */
+  int i;
+
+  if (writer.threaded) {
+    pthread_mutex_lock(&lock);
+    writer.done = 1;
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+  }
+
+  for (i = 0; i < WRITER_BUFFERS; i++)
+    free(writer.buffers[i]);
+  memset(&writer, 0, sizeof(writer));
+}
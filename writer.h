@@ -0,0 +1,53 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "ml6.h"
+
+#define WRITER_BUFFERS 2
+#define WRITER_SAVE 0
+#define WRITER_DISPLAY 1
+#define WRITER_STREAM 2
+
+struct write_job
+{
+  screen* s;
+  int kind;
+  char file[256];
+  int frame;
+};
+
+struct frame_writer
+{
+  screen* buffers[WRITER_BUFFERS];
+  screen* spare[WRITER_BUFFERS];
+  int spare_count;
+
+  struct write_job queue[WRITER_BUFFERS];
+  int head, count;
+  int busy;
+  int done;
+  int failed;
+  int threaded;
+};
+
+extern struct frame_writer writer;
+
+void
+writer_start();
+
+screen*
+writer_acquire();
+
+void
+writer_submit(screen*, int, char*, int);
+
+void
+writer_flush();
+
+int
+writer_failed();
+
+void
+writer_stop();
+
+#endif